@@ -29,10 +29,29 @@ LINKS=""
 
 if [ "$1" == "pressure-sim" ]; then
     $CC $CFLAGS -c pressure-sim-utils.c -o build/pressure-sim-utils.o
-    LINKS="build/pressure-sim-utils.o"
+    $CC $CFLAGS -c pressure-sim-physics.c -o build/pressure-sim-physics.o
+    $CC $CFLAGS -c pressure-sim-threadpool.c -o build/pressure-sim-threadpool.o
+    $CC $CFLAGS -c pressure-sim-collide.c -o build/pressure-sim-collide.o
+    $CC $CFLAGS -c pressure-sim-pressure.c -o build/pressure-sim-pressure.o
+    $CC $CFLAGS -c pressure-sim-events.c -o build/pressure-sim-events.o
+    $CC $CFLAGS -c pressure-sim-config.c -o build/pressure-sim-config.o
+    $CC $CFLAGS -c pressure-sim-simthread.c -o build/pressure-sim-simthread.o
+    LINKS="build/pressure-sim-utils.o build/pressure-sim-physics.o build/pressure-sim-threadpool.o build/pressure-sim-collide.o build/pressure-sim-pressure.o build/pressure-sim-events.o build/pressure-sim-config.o build/pressure-sim-simthread.o"
+    LINKFLAGS="$LINKFLAGS -pthread"
+fi
+
+if [ "$1" == "pressure-sim-bench" ]; then # headless, no SDL 
+    $CC $CFLAGS -c pressure-sim-physics.c -o build/pressure-sim-physics.o
+    $CC $CFLAGS -c pressure-sim-threadpool.c -o build/pressure-sim-threadpool.o
+    $CC $CFLAGS -c pressure-sim-collide.c -o build/pressure-sim-collide.o
+    $CC $CFLAGS -c pressure-sim-pressure.c -o build/pressure-sim-pressure.o
+    $CC $CFLAGS -c pressure-sim-events.c -o build/pressure-sim-events.o
+    $CC $CFLAGS -c pressure-sim-config.c -o build/pressure-sim-config.o
+    LINKS="build/pressure-sim-physics.o build/pressure-sim-threadpool.o build/pressure-sim-collide.o build/pressure-sim-pressure.o build/pressure-sim-events.o build/pressure-sim-config.o"
+    LINKFLAGS="$(echo $LINKFLAGS | sed 's/-lSDL3 //') -pthread"
 fi
 
 $CC $CFLAGS -c $1.c -o build/$1.o
-$CC $CFLAGS $LINKFLAGS $LINKS build/$1.o -o build/$1.bin
+$CC $CFLAGS $LINKS build/$1.o -o build/$1.bin $LINKFLAGS
 ls build/
 
@@ -0,0 +1,419 @@
+// Headless benchmark for the pressure simulation.
+// Builds the same Chunkmap as pressure-sim (setup_simulation_memory/setup_particles)
+// without SDL or a GPU device and runs physics_tick in a tight loop.
+// The last line on stdout is a single JSON record, so runs can be collected by scripts.
+#include "pressure-sim-physics.h"
+#include "pressure-sim-config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/resource.h>
+
+
+// What only the bench has, the simulation itself is a Config.
+typedef struct {
+    uint32_t steps;
+    uint32_t warmup;
+    bool verify;
+    float sim_time;
+    float view_zoom;
+    uint32_t density_tile;
+} BenchArgs;
+
+
+// The short flags are config keys, applied with config_set like the front
+// end's --key flags, so both get the same parsing and config_validate.
+static const struct {
+    char flag;
+    const char* key;
+} bench_flags[] = {
+    { 'n', "n" },
+    { 'r', "r" },
+    { 'v', "speed" },
+    { 't', "dt" },
+    { 'x', "chunks_x" },
+    { 'y', "chunks_y" },
+    { 'W', "width" },
+    { 'H', "height" },
+    { 'X', "boundary_x" },
+    { 'Y', "boundary_y" },
+    { 'S', "seed" },
+    { 'd', "engine" },
+    { 'i', "index" },
+    { 'l', "skin" },
+    { 'j', "threads" },
+    { 'k', "kernel" },
+    { 'p', "pairs" },
+    { 'c', "collide" },
+    { 'C', "cfl" },
+    { 'D', "dt_min" },
+    { 'O', "overlap_target" },
+    { 'L', "dt_log" },
+    { 'm', "reorder_interval" },
+    { 'M', "reorder_threshold" },
+    { 'a', "autotune" },
+    { 'g', "regrid_tolerance" },
+    { 'q', "pressure_segments" },
+    { 'z', "pressure_window" },
+    { 'o', "pressure_stream" },
+    { 'e', "virial_window" },
+    { 'E', "virial_field" },
+};
+
+#define BENCH_FLAGS_N (sizeof(bench_flags)/sizeof(bench_flags[0]))
+
+
+static double time_now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss; // kilobytes on linux
+}
+
+
+// FNV-1a over the positions and velocities in particle id order. Equal 
+// hashes mean bitwise equal states, whatever the slot order. 
+static uint64_t state_hash(Chunkmap* chunkmap) {
+    Particles* ps = &chunkmap->particles;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t id = 0; id < chunkmap->particles_n; id++) {
+        uint32_t p = chunkmap->id_slot[id];
+        float values[4] = { ps->x[p], ps->y[p], ps->vx[p], ps->vy[p] };
+        const unsigned char* bytes = (const unsigned char*) values;
+        for (size_t b = 0; b < sizeof values; b++) {
+            hash = (hash ^ bytes[b]) * 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+
+// What the render's camera shows at zoom, centred on (cx, cy) in container 
+// widths and heights. 
+static Box view_box(Container* container, float cx, float cy, float zoom) {
+    float half_w = 0.5f * container->width / zoom, half_h = 0.5f * container->height / zoom;
+    return (Box) { cx * container->width - half_w, cx * container->width + half_w, cy * container->height - half_h, cy * container->height + half_h };
+}
+
+
+// What particles_write_gpu_view has to find, by brute force. 
+static uint32_t view_scan(Chunkmap* chunkmap, Box view) {
+    Particles* ps = &chunkmap->particles;
+    uint32_t n = 0;
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        n += ps->x[p] + ps->rad[p] >= view.l && ps->x[p] - ps->rad[p] <= view.r && ps->y[p] + ps->rad[p] >= view.b && ps->y[p] - ps->rad[p] <= view.t;
+    }
+    return n;
+}
+
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n <particles>    number of particles (default 50000)\n"
+        "  -r <radius>       particle radius (default 1.0)\n"
+        "  -v <speed>        initial speed range (default 1000)\n"
+        "  -t <dt>           timestep (default 0.001)\n"
+        "  -x <chunks_x>     chunks along x (default 30)\n"
+        "  -y <chunks_y>     chunks along y (default 30)\n"
+        "  -W <width>        container width (default 1400)\n"
+        "  -H <height>       container height (default 1200)\n"
+        "  -X <boundary>     left and right side: walls, periodic (default walls)\n"
+        "  -Y <boundary>     bottom and top side: walls, periodic (default walls)\n"
+        "  -s <steps>        number of physics ticks (default 1000)\n"
+        "  -w <ticks>        untimed ticks before the measurement (default 0)\n"
+        "  -S <seed>         rng seed (default 0)\n"
+        "  -d <engine>       tick (fixed steps through the spatial index) or events (event driven hard disks, serial) (default tick)\n"
+        "  -i <index>        spatial index: chunkrefs, celllist, verlet (default chunkrefs)\n"
+        "  -l <skin>         verlet list skin, the lists are rebuilt once a particle moved skin/2 (default 0.5)\n"
+        "  -j <threads>      physics threads, 0 = one per core (default 1)\n"
+        "  -k <kernel>       collision kernel: scalar, sse, avx2, avx512 (default: best supported)\n"
+        "  -p <pairs>        pair mode: all, symmetric, jacobi (default all)\n"
+        "  -c <collide>      collisions: overlap, swept (time of impact within the tick, needs -p symmetric and -C) (default overlap)\n"
+        "  -C <cfl>          cap dt so no particle moves more than cfl radii per tick, 0 = fixed dt (default 0)\n"
+        "  -D <dt_min>       adapt dt between dt_min and -t to the fastest particle and the deepest overlap, 0 = fixed dt (default 0)\n"
+        "  -O <radii>        deepest overlap per tick the adaptive dt aims for (default 0.05)\n"
+        "  -L <file>         write the dt of every tick to a CSV file (default off)\n"
+        "  -T <time>         stop the timed ticks after this much simulated time, -s still caps the ticks (default off)\n"
+        "  -m <ticks>        Morton reorder of the particle slots every n ticks, 0 = off (default 0)\n"
+        "  -M <disorder>     Morton reorder when the slot disorder exceeds this (0..1), 0 = off (default 0)\n"
+        "  -a <ticks>        time every candidate chunk grid for n ticks before the run and keep the fastest, 0 = off (default 0)\n"
+        "  -g <factor>       re-tune the chunk grid once the density changes by this factor, 0 = off (default 0)\n"
+        "  -q <segments>     measure the wall pressure in this many segments per wall, 0 = off (default 0)\n"
+        "  -z <ticks>        ticks per wall pressure sample (default 100)\n"
+        "  -o <file>         write every wall pressure sample to file, .csv or binary (default off)\n"
+        "  -e <ticks>        sample the stress per chunk from the contact virial every n ticks, 0 = off (default 0)\n"
+        "  -E <file>         write the mean stress per chunk to a CSV file after the run (default off)\n"
+        "  -Z <zoom>         time particles_write_gpu_view for a camera this far zoomed into the bottom left corner after the run and check the count, also for a view panned off the container, 0 = off (default 0)\n"
+        "  -G <tile>         time particles_write_density for a grid of tile x tile cells over the container after the run, 0 = off (default 0)\n"
+        "  -V <0|1>          check every supported kernel against the scalar overlap test after the run\n"
+        "  -F <file>         apply a config file, see pressure-sim --help for the keys\n"
+        "  --<key> <value>   set any config key, flags and files apply in order\n", prog);
+}
+
+
+static int parse_args(int argc, char* argv[], BenchArgs* args, Config* config) {
+    for (int i = 1; i < argc; i++) {
+        const char* flag = argv[i];
+        if (strcmp(flag, "-h") == 0 || strcmp(flag, "--help") == 0) {
+            return -1;
+        }
+        if (i + 1 >= argc || flag[0] != '-' || (strlen(flag) != 2 && flag[1] != '-')) {
+            fprintf(stderr, "ERROR: invalid argument '%s'\n", flag);
+            return -1;
+        }
+        const char* value = argv[++i];
+        if (flag[1] == '-') {
+            if (config_set(config, flag + 2, value) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        const char* key = NULL;
+        for (uint32_t k = 0; k < BENCH_FLAGS_N; k++) {
+            if (bench_flags[k].flag == flag[1]) {
+                key = bench_flags[k].key;
+            }
+        }
+        if (key != NULL) {
+            if (config_set(config, key, value) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        switch (flag[1]) {
+        case 's': args->steps = strtoul(value, NULL, 10); break;
+        case 'w': args->warmup = strtoul(value, NULL, 10); break;
+        case 'T': args->sim_time = strtof(value, NULL); break;
+        case 'V': args->verify = strtoul(value, NULL, 10) != 0; break;
+        case 'Z': args->view_zoom = strtof(value, NULL); break;
+        case 'G': args->density_tile = strtoul(value, NULL, 10); break;
+        case 'F': {
+            if (config_load(config, value) < 0) {
+                return -1;
+            }
+        } break;
+        default: {
+            fprintf(stderr, "ERROR: unknown flag '%s'\n", flag);
+            return -1;
+        } break;
+        }
+    }
+    // no window here, so the zoom is chosen such that the particle lattice fills the container
+    config->zoom = 2.0f / new_max(config->height, 1u);
+    if (config_validate(config) < 0) {
+        return -1;
+    }
+    if (config->pressure_window == 0) { // it also sizes the pressure history
+        fprintf(stderr, "ERROR: the wall pressure window must be at least one tick\n");
+        return -1;
+    }
+    if (args->view_zoom != 0.0f && !(args->view_zoom >= 1.0f)) {
+        fprintf(stderr, "ERROR: -Z must be 0 or at least 1\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    BenchArgs args = {
+        .steps = 1000,
+        .warmup = 0,
+        .verify = false,
+        .sim_time = 0.0f,
+        .view_zoom = 0.0f,
+        .density_tile = 0
+    };
+    // the front end's defaults, except one thread and no disorder driven reorder
+    Config config;
+    config_defaults(&config);
+    config.threads = 1;
+    config.reorder_threshold = 0.0f;
+    if (parse_args(argc, argv, &args, &config) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    srand(config.seed);
+
+    Container container;
+    config_container(&config, &container);
+
+    Chunkmap chunkmap = { 0 };
+    chunkmap_init(&chunkmap, &container, config.chunks_x, config.chunks_y, config.particles_n, config.particle_radius);
+
+    // the pool comes first, setup_particles bins the particles on it
+    Threadpool pool;
+    if (threadpool_init(&pool, config.threads) < 0) {
+        return 1;
+    }
+    double t_setup = time_now_s();
+    void* mem_block = NULL;
+    if (setup_simulation_memory(&mem_block, &chunkmap) < 0) {
+        chunkmap_teardown(&chunkmap, &pool, mem_block);
+        return 1;
+    }
+    if (chunkmap_set_threadpool(&chunkmap, &pool) < 0 || setup_particles(&chunkmap, config.particle_radius, config.speed, &container) < 0) {
+        fprintf(stderr, "ERROR: sim setup failed.\n");
+        chunkmap_teardown(&chunkmap, &pool, mem_block);
+        return 1;
+    }
+    t_setup = time_now_s() - t_setup;
+    chunkmap.verlet.skin = config.skin;
+    if (chunkmap_set_boundary(&chunkmap, config.boundary_x, config.boundary_y) < 0 || chunkmap_set_spatial_index(&chunkmap, config.spatial_index) < 0) {
+        chunkmap_teardown(&chunkmap, &pool, mem_block);
+        return 1;
+    }
+    chunkmap.collide_kernel = config.collide_kernel;
+    chunkmap.pair_mode = config.pair_mode;
+    chunkmap.reorder_interval = config.reorder_interval;
+    chunkmap.reorder_threshold = config.reorder_threshold;
+    chunkmap.autotune_ticks = config.autotune;
+    chunkmap.regrid_tolerance = config.regrid_tolerance;
+    // the history holds every sample of the run, so the stats cover all of it 
+    if (chunkmap_set_collide_mode(&chunkmap, config.collide_mode, config.cfl, config.particle_radius) < 0 ||
+        chunkmap_set_engine(&chunkmap, config.engine) < 0 ||
+        pressure_init(&chunkmap, config.pressure_segments, config.pressure_window, (args.warmup + args.steps) / config.pressure_window + 1) < 0 || 
+        (config.pressure_segments > 0 && config.pressure_stream[0] != '\0' && pressure_stream_open(&chunkmap.pressure, config.pressure_stream) < 0) || 
+        virial_init(&chunkmap, config.virial_window) < 0 ||
+        dt_control_init(&chunkmap, config.dt_min, config.overlap_target, config.dt_log) < 0) {
+        chunkmap_teardown(&chunkmap, &pool, mem_block);
+        return 1;
+    }
+    double t_autotune = time_now_s();
+    if (config.autotune > 0 && chunkmap_autotune(&chunkmap, config.autotune, config.dt, config.particle_radius, &container) < 0) {
+        chunkmap_teardown(&chunkmap, &pool, mem_block);
+        return 1;
+    }
+    t_autotune = time_now_s() - t_autotune;
+
+    double t_run = time_now_s();
+    double sim_start = 0.0;
+    uint32_t step = 0;
+    for (; step < args.warmup + args.steps; step++) {
+        if (step == args.warmup) {
+            chunkmap.membership = (MembershipStats) { 0 };
+            chunkmap.verlet.builds = 0;
+            chunkmap.events.events = 0;
+            chunkmap.events.collisions = 0;
+            chunkmap.events.invalid = 0;
+            chunkmap.dt_control.shrinks = 0;
+            t_run = time_now_s();
+            sim_start = chunkmap.time;
+        }
+        if (args.sim_time > 0.0f && step >= args.warmup && chunkmap.time - sim_start >= args.sim_time) {
+            break;
+        }
+        if (physics_tick(config.dt, &chunkmap, config.particle_radius, &container) < 0) {
+            fprintf(stderr, "ERROR: physics_tick failed at step %d.\n", step);
+            chunkmap_teardown(&chunkmap, &pool, mem_block);
+            return 1;
+        }
+    }
+    t_run = time_now_s() - t_run;
+    args.steps = step - args.warmup; // fewer with -T
+    double sim_time = chunkmap.time - sim_start;
+
+    // kinetic energy is conserved by collide and the walls, so it is the cross-check between the serial and threaded paths
+    double energy = 0.0;
+    for (uint32_t p = 0; p < chunkmap.particles_n; p++) {
+        energy += 0.5 * chunkmap.particles.mass[p] * ((double) chunkmap.particles.vx[p] * chunkmap.particles.vx[p] + (double) chunkmap.particles.vy[p] * chunkmap.particles.vy[p]);
+    }
+
+    // a 2D ideal gas has P * area = N * kT = kinetic energy, a dilute run 
+    // reads close to it 
+    PressureStats pressure;
+    pressure_stats(&chunkmap.pressure, &pressure);
+    double pressure_ideal = energy / ((double) config.width * config.height);
+    // the bulk pressure from the virial has to agree with the walls 
+    double virial_pressure = chunkmap.virial.samples > 0 ? chunkmap.virial.pressure_sum / chunkmap.virial.samples : 0.0;
+    if (config.virial_field[0] != '\0' && chunkmap.virial.enabled) {
+        FILE* field = fopen(config.virial_field, "w");
+        if (field == NULL) {
+            fprintf(stderr, "ERROR: could not open %s\n", config.virial_field);
+        } else {
+            virial_write(&chunkmap, field);
+            fclose(field);
+        }
+    }
+
+    double ticks_per_s = args.steps / t_run;
+    double ns_per_particle_step = t_run * 1e9 / ((double) args.steps * config.particles_n);
+    // kernels are checked on the final state, which is a well mixed gas with plenty of contacts
+    uint64_t kernel_mismatches = 0;
+    if (args.verify) {
+        for (uint32_t k = 0; k < COLLIDE_COUNTER; k++) {
+            if (!collide_kernel_supported(k)) continue;
+            uint64_t mismatches = collide_kernel_verify(&chunkmap, k);
+            printf("verify %s: %lu mismatches\n", collide_kernel_to_name(k), (unsigned long) mismatches);
+            kernel_mismatches += mismatches;
+        }
+    }
+
+    // the render's snapshot write for a zoomed in camera, its cost has to 
+    // follow the particles in view. The count is checked against a scan, 
+    // also for a camera panned more than a container width off to the left, 
+    // where the chunk range of a periodic axis must not wrap out of bounds. 
+    uint32_t view_instances = 0, view_expected = 0, view_off_instances = 0, view_off_expected = 0;
+    double view_write_ns = 0.0;
+    if (args.view_zoom >= 1.0f) {
+        Box view = view_box(&container, 0.5f / args.view_zoom, 0.5f / args.view_zoom, args.view_zoom);
+        GPUParticle* gpu_particles = malloc(chunkmap.particles_n * sizeof gpu_particles[0]);
+        if (gpu_particles != NULL) {
+            const uint32_t repeats = 20;
+            double t_view = time_now_s();
+            for (uint32_t k = 0; k < repeats; k++) {
+                view_instances = particles_write_gpu_view(&chunkmap, &container, view, config.particle_radius, false, gpu_particles);
+            }
+            view_write_ns = (time_now_s() - t_view) * 1e9 / repeats;
+            Box view_off = view_box(&container, -9.5f, 0.25f, args.view_zoom);
+            view_off_instances = particles_write_gpu_view(&chunkmap, &container, view_off, config.particle_radius, false, gpu_particles);
+            view_off_expected = view_scan(&chunkmap, view_off);
+            free(gpu_particles);
+        }
+        view_expected = view_scan(&chunkmap, view);
+    }
+
+    // the density grid the render draws instead past the lod threshold, its 
+    // cost is one pass over the particles plus one over the cells. 
+    uint32_t density_cells = 0, density_binned = 0;
+    double density_write_ns = 0.0;
+    if (args.density_tile > 0) {
+        uint32_t grid_w = (container.width + args.density_tile - 1) / args.density_tile;
+        uint32_t grid_h = (container.height + args.density_tile - 1) / args.density_tile;
+        density_cells = grid_w * grid_h;
+        float* bins = malloc(2 * (size_t) density_cells * sizeof bins[0]);
+        uint8_t (*texels)[4] = malloc((size_t) density_cells * sizeof texels[0]);
+        if (bins != NULL && texels != NULL) {
+            Box view = { .l = 0.0f, .r = (float) container.width, .b = 0.0f, .t = (float) container.height };
+            const uint32_t repeats = 20;
+            double t_density = time_now_s();
+            for (uint32_t k = 0; k < repeats; k++) {
+                density_binned = particles_write_density(&chunkmap, view, grid_w, grid_h, bins, texels);
+            }
+            density_write_ns = (time_now_s() - t_density) * 1e9 / repeats;
+        }
+        free(bins);
+        free(texels);
+    }
+
+    printf("{\"n\":%u,\"r\":%g,\"speed\":%g,\"dt\":%g,\"chunks_x\":%u,\"chunks_y\":%u,\"width\":%u,\"height\":%u,\"boundary_x\":\"%s\",\"boundary_y\":\"%s\","
+           "\"steps\":%u,\"warmup\":%u,\"seed\":%u,\"engine\":\"%s\",\"index\":\"%s\",\"threads\":%u,\"kernel\":\"%s\",\"pairs\":\"%s\",\"collide\":\"%s\",\"cfl\":%g,\"dt_min\":%g,\"overlap_target\":%g,\"dt_last\":%g,\"dt_mean\":%g,\"dt_shrinks\":%u,\"sim_time\":%.6g,\"reorders\":%u,\"disorder\":%.4f,\"regrids\":%u,\"pops_per_tick\":%.1f,\"appends_per_tick\":%.1f,\"skin\":%g,\"verlet_builds\":%u,\"ticks_per_build\":%.2f,\"verlet_bytes\":%zu,\"events\":%llu,\"event_collisions\":%llu,\"event_invalid\":%llu,\"setup_s\":%.6f,\"autotune_s\":%.6f,\"run_s\":%.6f,\"ticks_per_s\":%.3f,\"ns_per_particle_step\":%.3f,\"peak_rss_kb\":%ld,\"energy\":%.9g,\"pressure_samples\":%u,\"pressure\":[%g,%g,%g,%g,%g],\"pressure_std\":[%g,%g,%g,%g,%g],\"pressure_ideal\":%g,\"virial_samples\":%lu,\"virial_pressure\":%g,\"state_hash\":\"%016llx\",\"kernel_mismatches\":%lu,\"view_zoom\":%g,\"view_instances\":%u,\"view_expected\":%u,\"view_write_ns\":%.0f,\"view_off_instances\":%u,\"view_off_expected\":%u,\"density_tile\":%u,\"density_cells\":%u,\"density_binned\":%u,\"density_write_ns\":%.0f}\n",
+        config.particles_n, config.particle_radius, config.speed, config.dt, chunkmap.chunks_x, chunkmap.chunks_y, config.width, config.height, boundary_to_name(config.boundary_x), boundary_to_name(config.boundary_y),
+        args.steps, args.warmup, config.seed, engine_to_name(chunkmap.engine), spatial_index_to_name(config.spatial_index), pool.threads, collide_kernel_to_name(chunkmap.collide_kernel), pair_mode_to_name(chunkmap.pair_mode), collide_mode_to_name(chunkmap.collide_mode), chunkmap.cfl, config.dt_min, config.overlap_target, chunkmap.dt_tick, args.steps > 0 ? sim_time / args.steps : 0.0, chunkmap.dt_control.shrinks, sim_time, chunkmap.reorders, particles_disorder(&chunkmap), chunkmap.regrids, (double) chunkmap.membership.pops / args.steps, (double) chunkmap.membership.appends / args.steps, config.skin, chunkmap.verlet.builds, chunkmap.verlet.builds > 0 ? (double) args.steps / chunkmap.verlet.builds : 0.0, verlet_memory_size(&chunkmap), (unsigned long long) chunkmap.events.events, (unsigned long long) chunkmap.events.collisions, (unsigned long long) chunkmap.events.invalid, t_setup, t_autotune, t_run, ticks_per_s, ns_per_particle_step, peak_rss_kb(), energy, pressure.samples,
+        pressure.mean[WALL_LEFT], pressure.mean[WALL_RIGHT], pressure.mean[WALL_BOTTOM], pressure.mean[WALL_TOP], pressure.mean[WALL_COUNTER],
+        sqrtf(pressure.variance[WALL_LEFT]), sqrtf(pressure.variance[WALL_RIGHT]), sqrtf(pressure.variance[WALL_BOTTOM]), sqrtf(pressure.variance[WALL_TOP]), sqrtf(pressure.variance[WALL_COUNTER]), pressure_ideal, (unsigned long) chunkmap.virial.samples, virial_pressure, (unsigned long long) state_hash(&chunkmap), (unsigned long) kernel_mismatches, args.view_zoom, view_instances, view_expected, view_write_ns, view_off_instances, view_off_expected, args.density_tile, density_cells, density_binned, density_write_ns);
+
+    chunkmap_teardown(&chunkmap, &pool, mem_block);
+    return kernel_mismatches == 0 ? 0 : 1;
+}
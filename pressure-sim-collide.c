@@ -0,0 +1,293 @@
+// Narrow phase: which candidates of a list overlap particle p.
+// The overlap test is the one in collide, the kernels only batch it over
+// 4/8/16 candidates and collide runs for the hits alone. collide does not
+// move x/y, so testing a whole block before the responses gives the same
+// hits as testing pair by pair. Along a periodic axis the separations are
+// taken as their shortest image, see min_image.
+#include "pressure-sim-physics.h"
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COLLIDE_X86
+#include <immintrin.h>
+#endif
+
+
+static uint32_t collide_hits_scalar(Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits) {
+    float px = ps->x[p], py = ps->y[p], pr = ps->rad[p];
+    uint32_t hits_n = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t o = others[k];
+        float dx = min_image(px - ps->x[o], ps->period_x);
+        float dy = min_image(py - ps->y[o], ps->period_y);
+        float dr = pr + ps->rad[o];
+        if (dx*dx + dy*dy <= dr*dr*1.000f) {
+            hits[hits_n++] = o;
+        }
+    }
+    return hits_n;
+}
+
+
+#ifdef COLLIDE_X86
+
+#define collide_lanes4(_col, _o) (_col)[(_o)[0]], (_col)[(_o)[1]], (_col)[(_o)[2]], (_col)[(_o)[3]]
+
+// appends others[base + bit] for every set bit of mask
+static inline uint32_t collide_push_mask(uint32_t mask, const uint32_t* others, uint32_t base, uint32_t* hits, uint32_t hits_n) {
+    while (mask) {
+        hits[hits_n++] = others[base + __builtin_ctz(mask)];
+        mask &= mask - 1;
+    }
+    return hits_n;
+}
+
+
+// min_image over 4 lanes, period and half are the period and half of it
+__attribute__((target("sse2")))
+static inline __m128 collide_wrap_sse(__m128 d, __m128 period, __m128 half) {
+    __m128 over = _mm_and_ps(_mm_cmpgt_ps(d, half), period);
+    __m128 under = _mm_and_ps(_mm_cmplt_ps(d, _mm_sub_ps(_mm_setzero_ps(), half)), period);
+    return _mm_add_ps(_mm_sub_ps(d, over), under);
+}
+
+
+__attribute__((target("sse2"), always_inline))
+static inline uint32_t collide_hits_sse_body(Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits, bool wrap) {
+    __m128 px = _mm_set1_ps(ps->x[p]);
+    __m128 py = _mm_set1_ps(ps->y[p]);
+    __m128 pr = _mm_set1_ps(ps->rad[p]);
+    __m128 period_x = _mm_set1_ps(ps->period_x), half_x = _mm_set1_ps(0.5f * ps->period_x);
+    __m128 period_y = _mm_set1_ps(ps->period_y), half_y = _mm_set1_ps(0.5f * ps->period_y);
+    uint32_t hits_n = 0;
+    uint32_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        const uint32_t* o = others + k;
+        // no gather before AVX2
+        __m128 ox = _mm_setr_ps(collide_lanes4(ps->x, o));
+        __m128 oy = _mm_setr_ps(collide_lanes4(ps->y, o));
+        __m128 orad = _mm_setr_ps(collide_lanes4(ps->rad, o));
+        __m128 dx = _mm_sub_ps(px, ox);
+        __m128 dy = _mm_sub_ps(py, oy);
+        if (wrap) {
+            dx = collide_wrap_sse(dx, period_x, half_x);
+            dy = collide_wrap_sse(dy, period_y, half_y);
+        }
+        __m128 dr = _mm_add_ps(pr, orad);
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        uint32_t mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_mul_ps(dr, dr)));
+        hits_n = collide_push_mask(mask, others, k, hits, hits_n);
+    }
+    return hits_n + collide_hits_scalar(ps, p, others + k, n - k, hits + hits_n);
+}
+
+
+// wrap is a constant in each call, so the walls case compiles without it,
+// the same for the avx2 and avx512 wrappers below
+__attribute__((target("sse2")))
+static uint32_t collide_hits_sse(Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits) {
+    if (ps->period_x > 0.0f || ps->period_y > 0.0f) {
+        return collide_hits_sse_body(ps, p, others, n, hits, true);
+    }
+    return collide_hits_sse_body(ps, p, others, n, hits, false);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256 collide_wrap_avx2(__m256 d, __m256 period, __m256 half) {
+    __m256 over = _mm256_and_ps(_mm256_cmp_ps(d, half, _CMP_GT_OQ), period);
+    __m256 under = _mm256_and_ps(_mm256_cmp_ps(d, _mm256_sub_ps(_mm256_setzero_ps(), half), _CMP_LT_OQ), period);
+    return _mm256_add_ps(_mm256_sub_ps(d, over), under);
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline uint32_t collide_hits_avx2_body(Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits, bool wrap) {
+    __m256 px = _mm256_set1_ps(ps->x[p]);
+    __m256 py = _mm256_set1_ps(ps->y[p]);
+    __m256 pr = _mm256_set1_ps(ps->rad[p]);
+    __m256 period_x = _mm256_set1_ps(ps->period_x), half_x = _mm256_set1_ps(0.5f * ps->period_x);
+    __m256 period_y = _mm256_set1_ps(ps->period_y), half_y = _mm256_set1_ps(0.5f * ps->period_y);
+    uint32_t hits_n = 0;
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256i o = _mm256_loadu_si256((const __m256i*)(others + k));
+        __m256 ox = _mm256_i32gather_ps(ps->x, o, 4);
+        __m256 oy = _mm256_i32gather_ps(ps->y, o, 4);
+        __m256 orad = _mm256_i32gather_ps(ps->rad, o, 4);
+        __m256 dx = _mm256_sub_ps(px, ox);
+        __m256 dy = _mm256_sub_ps(py, oy);
+        if (wrap) {
+            dx = collide_wrap_avx2(dx, period_x, half_x);
+            dy = collide_wrap_avx2(dy, period_y, half_y);
+        }
+        __m256 dr = _mm256_add_ps(pr, orad);
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        uint32_t mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(dr, dr), _CMP_LE_OQ));
+        hits_n = collide_push_mask(mask, others, k, hits, hits_n);
+    }
+    // the caller and collide are plain SSE code, leaving the upper halves 
+    // dirty makes every SSE instruction after this pay a transition penalty 
+    _mm256_zeroupper();
+    return hits_n + collide_hits_scalar(ps, p, others + k, n - k, hits + hits_n);
+}
+
+
+__attribute__((target("avx2")))
+static uint32_t collide_hits_avx2(Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits) {
+    if (ps->period_x > 0.0f || ps->period_y > 0.0f) {
+        return collide_hits_avx2_body(ps, p, others, n, hits, true);
+    }
+    return collide_hits_avx2_body(ps, p, others, n, hits, false);
+}
+
+
+__attribute__((target("avx512f")))
+static inline __m512 collide_wrap_avx512(__m512 d, __m512 period, __m512 half) {
+    d = _mm512_mask_sub_ps(d, _mm512_cmp_ps_mask(d, half, _CMP_GT_OQ), d, period);
+    return _mm512_mask_add_ps(d, _mm512_cmp_ps_mask(d, _mm512_sub_ps(_mm512_setzero_ps(), half), _CMP_LT_OQ), d, period);
+}
+
+
+__attribute__((target("avx512f"), always_inline))
+static inline uint32_t collide_hits_avx512_body(Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits, bool wrap) {
+    __m512 px = _mm512_set1_ps(ps->x[p]);
+    __m512 py = _mm512_set1_ps(ps->y[p]);
+    __m512 pr = _mm512_set1_ps(ps->rad[p]);
+    __m512 period_x = _mm512_set1_ps(ps->period_x), half_x = _mm512_set1_ps(0.5f * ps->period_x);
+    __m512 period_y = _mm512_set1_ps(ps->period_y), half_y = _mm512_set1_ps(0.5f * ps->period_y);
+    uint32_t hits_n = 0;
+    uint32_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m512i o = _mm512_loadu_si512((const void*)(others + k));
+        __m512 ox = _mm512_i32gather_ps(o, ps->x, 4);
+        __m512 oy = _mm512_i32gather_ps(o, ps->y, 4);
+        __m512 orad = _mm512_i32gather_ps(o, ps->rad, 4);
+        __m512 dx = _mm512_sub_ps(px, ox);
+        __m512 dy = _mm512_sub_ps(py, oy);
+        if (wrap) {
+            dx = collide_wrap_avx512(dx, period_x, half_x);
+            dy = collide_wrap_avx512(dy, period_y, half_y);
+        }
+        __m512 dr = _mm512_add_ps(pr, orad);
+        __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        uint32_t mask = _mm512_cmp_ps_mask(d2, _mm512_mul_ps(dr, dr), _CMP_LE_OQ);
+        hits_n = collide_push_mask(mask, others, k, hits, hits_n);
+    }
+    _mm256_zeroupper();
+    return hits_n + collide_hits_scalar(ps, p, others + k, n - k, hits + hits_n);
+}
+
+
+__attribute__((target("avx512f")))
+static uint32_t collide_hits_avx512(Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits) {
+    if (ps->period_x > 0.0f || ps->period_y > 0.0f) {
+        return collide_hits_avx512_body(ps, p, others, n, hits, true);
+    }
+    return collide_hits_avx512_body(ps, p, others, n, hits, false);
+}
+
+#endif // COLLIDE_X86
+
+
+bool collide_kernel_supported(CollideKernel kernel) {
+    switch (kernel) {
+    case COLLIDE_SCALAR: return true;
+#ifdef COLLIDE_X86
+    case COLLIDE_SSE: return __builtin_cpu_supports("sse2");
+    case COLLIDE_AVX2: return __builtin_cpu_supports("avx2");
+    case COLLIDE_AVX512: return __builtin_cpu_supports("avx512f");
+#endif // COLLIDE_X86
+    default: return false;
+    }
+}
+
+
+CollideKernel collide_kernel_detect(void) {
+    for (CollideKernel kernel = COLLIDE_COUNTER; kernel-- > COLLIDE_SCALAR;) {
+        if (collide_kernel_supported(kernel)) {
+            return kernel;
+        }
+    }
+    return COLLIDE_SCALAR;
+}
+
+
+// n <= COLLIDE_BLOCK, hits needs room for n entries
+uint32_t collide_hits(CollideKernel kernel, Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits) {
+    switch (kernel) {
+#ifdef COLLIDE_X86
+    case COLLIDE_SSE: return collide_hits_sse(ps, p, others, n, hits);
+    case COLLIDE_AVX2: return collide_hits_avx2(ps, p, others, n, hits);
+    case COLLIDE_AVX512: return collide_hits_avx512(ps, p, others, n, hits);
+#endif // COLLIDE_X86
+    default: return collide_hits_scalar(ps, p, others, n, hits);
+    }
+}
+
+
+// collide(p, other) for every other in the list that overlaps p, p itself is skipped
+void collide_list(CollideKernel kernel, Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, VirialRow* vr) {
+    uint32_t hits[COLLIDE_BLOCK];
+    for (uint32_t base = 0; base < n; base += COLLIDE_BLOCK) {
+        uint32_t block = n - base < COLLIDE_BLOCK ? n - base : COLLIDE_BLOCK;
+        uint32_t hits_n = collide_hits(kernel, ps, p, others + base, block, hits);
+        for (uint32_t h = 0; h < hits_n; h++) {
+            if (hits[h] != p) {
+                collide(ps, p, hits[h], vr);
+            }
+        }
+    }
+}
+
+
+// collide_symmetric(p, other) for every other in the list that overlaps p, the list must not contain p,
+// collide_swept for every other while the collisions are swept
+void collide_list_symmetric(CollideKernel kernel, Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, VirialRow* vr) {
+    uint32_t hits[COLLIDE_BLOCK];
+    if (ps->sweep_dt > 0.0f) {
+        // the overlap kernels would drop the pairs that only meet later in the tick
+        for (uint32_t k = 0; k < n; k++) {
+            collide_swept(ps, p, others[k], vr);
+        }
+        return;
+    }
+    for (uint32_t base = 0; base < n; base += COLLIDE_BLOCK) {
+        uint32_t block = n - base < COLLIDE_BLOCK ? n - base : COLLIDE_BLOCK;
+        uint32_t hits_n = collide_hits(kernel, ps, p, others + base, block, hits);
+        for (uint32_t h = 0; h < hits_n; h++) {
+            collide_symmetric(ps, p, hits[h], vr);
+        }
+    }
+}
+
+
+// Runs kernel and the scalar test over the chunks of every particle and
+// returns the number of blocks where the hit lists differ.
+uint64_t collide_kernel_verify(Chunkmap* chunkmap, CollideKernel kernel) {
+    Particles* ps = &chunkmap->particles;
+    uint64_t mismatches = 0;
+    uint32_t hits[COLLIDE_BLOCK], hits_ref[COLLIDE_BLOCK];
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        for (uint32_t r = 0; r < 4; r++) {
+            Chunk* chunk = ps->chunk_refs[p][r].chunk;
+            if (chunk == NULL) continue;
+            for (uint32_t base = 0; base < chunk->particles_filled; base += COLLIDE_BLOCK) {
+                uint32_t block = chunk->particles_filled - base < COLLIDE_BLOCK ? chunk->particles_filled - base : COLLIDE_BLOCK;
+                uint32_t n = collide_hits(kernel, ps, p, chunk->particles + base, block, hits);
+                uint32_t n_ref = collide_hits_scalar(ps, p, chunk->particles + base, block, hits_ref);
+                bool same = n == n_ref;
+                for (uint32_t h = 0; same && h < n; h++) {
+                    same = hits[h] == hits_ref[h];
+                }
+                if (!same) {
+#ifdef DEBUG
+                    printf("collide_kernel_verify: %s differs for p=%d in chunk %d,%d\n", collide_kernel_to_name(kernel), p, chunk->x, chunk->y);
+#endif // DEBUG
+                    mismatches++;
+                }
+            }
+        }
+    }
+    return mismatches;
+}
@@ -0,0 +1,467 @@
+// Runtime configuration: defaults, key=value files, command line flags and
+// the checks that used to be implicit in the compile time constants.
+#include "pressure-sim-config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+
+typedef enum {
+    CONFIG_U32,
+    CONFIG_F32,
+    CONFIG_INDEX,
+    CONFIG_KERNEL,
+    CONFIG_PAIRS,
+    CONFIG_BOUNDARY,
+    CONFIG_COLLIDE,
+    CONFIG_ENGINE,
+    CONFIG_PACE,
+    CONFIG_PATH,
+} ConfigType;
+
+
+typedef struct {
+    const char* key;
+    ConfigType type;
+    size_t offset;
+    const char* help;
+} ConfigKey;
+
+
+#define config_key(_key, _type, _field, _help) { _key, _type, offsetof(Config, _field), _help }
+
+static const ConfigKey config_keys[] = {
+    config_key("n",                 CONFIG_U32,    particles_n,       "number of particles"),
+    config_key("r",                 CONFIG_F32,    particle_radius,   "particle radius"),
+    config_key("speed",             CONFIG_F32,    speed,             "initial speed range"),
+    config_key("dt",                CONFIG_F32,    dt,                "timestep"),
+    config_key("chunks_x",          CONFIG_U32,    chunks_x,          "chunks along x"),
+    config_key("chunks_y",          CONFIG_U32,    chunks_y,          "chunks along y"),
+    config_key("width",             CONFIG_U32,    width,             "window and container width"),
+    config_key("height",            CONFIG_U32,    height,            "window and container height"),
+    config_key("boundary_x",        CONFIG_BOUNDARY, boundary_x,      "left and right side: walls, periodic"),
+    config_key("boundary_y",        CONFIG_BOUNDARY, boundary_y,      "bottom and top side: walls, periodic"),
+    config_key("zoom",              CONFIG_F32,    zoom,              "container units to gpu coords"),
+    config_key("seed",              CONFIG_U32,    seed,              "rng seed"),
+    config_key("threads",           CONFIG_U32,    threads,           "physics threads, 0 = one per core"),
+    config_key("pace",              CONFIG_PACE,   pace,              "ticks per frame: frame (one per refresh), realtime (time_scale), fast (as many as fit the frame budget)"),
+    config_key("time_scale",        CONFIG_F32,    time_scale,        "simulated seconds per wall clock second with pace=realtime"),
+    config_key("frame_budget",      CONFIG_F32,    frame_budget,      "milliseconds of ticks between two snapshots for the render at most, pace=realtime and fast"),
+    config_key("zero_copy",         CONFIG_U32,    zero_copy,         "1: the physics thread writes the positions straight into mapped upload buffers, 0: the render copies them"),
+    config_key("quantize",          CONFIG_U32,    quantize,          "1: positions go to the gpu as 16 bit unorm (4 bytes per particle), 0: as floats (8 bytes)"),
+    config_key("lod_threshold",     CONFIG_F32,    lod_threshold,     "particles per pixel in view from which a density grid is drawn instead of the particles, 0 = off"),
+    config_key("lod_tile",          CONFIG_U32,    lod_tile,          "pixels per density grid cell along each axis"),
+    config_key("engine",            CONFIG_ENGINE, engine,            "tick (fixed steps through the spatial index) or events (event driven hard disks, serial)"),
+    config_key("index",             CONFIG_INDEX,  spatial_index,     "spatial index: chunkrefs, celllist, verlet"),
+    config_key("kernel",            CONFIG_KERNEL, collide_kernel,    "collision kernel: scalar, sse, avx2, avx512"),
+    config_key("pairs",             CONFIG_PAIRS,  pair_mode,         "pair mode: all, symmetric, jacobi"),
+    config_key("collide",           CONFIG_COLLIDE, collide_mode,     "collisions: overlap (at the end of a tick), swept (time of impact within the tick, needs pairs=symmetric and cfl)"),
+    config_key("cfl",               CONFIG_F32,    cfl,               "cap dt so no particle moves more than cfl radii per tick, 0 = fixed dt"),
+    config_key("dt_min",            CONFIG_F32,    dt_min,            "adapt dt between dt_min and dt to the fastest particle and the deepest overlap, 0 = fixed dt"),
+    config_key("overlap_target",    CONFIG_F32,    overlap_target,    "deepest overlap per tick the adaptive dt aims for, in radii"),
+    config_key("dt_log",            CONFIG_PATH,   dt_log,            "write the dt of every tick to this CSV file, empty = off"),
+    config_key("reorder_interval",  CONFIG_U32,    reorder_interval,  "Morton reorder every n ticks, 0 = off"),
+    config_key("reorder_threshold", CONFIG_F32,    reorder_threshold, "Morton reorder above this slot disorder (0..1), 0 = off"),
+    config_key("autotune",          CONFIG_U32,    autotune,          "ticks timed per candidate chunk grid at startup, 0 = off"),
+    config_key("regrid_tolerance",  CONFIG_F32,    regrid_tolerance,  "re-tune the chunk grid once the density changes by this factor (> 1), 0 = off"),
+    config_key("skin",              CONFIG_F32,    skin,              "verlet list skin, the lists are rebuilt once a particle moved skin/2"),
+    config_key("pressure_segments", CONFIG_U32,    pressure_segments, "measure the wall pressure in this many segments per wall, 0 = off"),
+    config_key("pressure_window",   CONFIG_U32,    pressure_window,   "ticks per wall pressure sample"),
+    config_key("pressure_history",  CONFIG_U32,    pressure_history,  "wall pressure samples kept for mean and variance"),
+    config_key("pressure_stream",   CONFIG_PATH,   pressure_stream,   "write every wall pressure sample to this file, .csv or binary, empty = off"),
+    config_key("virial_window",     CONFIG_U32,    virial_window,     "ticks per sample of the stress per chunk from the contact virial, 0 = off"),
+    config_key("virial_field",      CONFIG_PATH,   virial_field,      "write the mean stress per chunk to this CSV file at exit, empty = off"),
+};
+
+#define CONFIG_KEYS_N (sizeof(config_keys)/sizeof(config_keys[0]))
+
+
+void config_defaults(Config* config) {
+    *config = (Config) {
+        .particles_n = 50000,
+        .particle_radius = 1.0f,
+        .speed = 1000.0f,
+        .dt = 0.001f,
+        .chunks_x = 30,
+        .chunks_y = 30,
+        .width = 1400,
+        .height = 1200,
+        .boundary_x = BOUNDARY_WALLS,
+        .boundary_y = BOUNDARY_WALLS,
+        .zoom = 1/500.0f,
+        .seed = 0,
+        .threads = 0,
+        .pace = PACE_REALTIME,
+        .time_scale = 0.1f,
+        .frame_budget = 12.0f,
+        .zero_copy = 1,
+        .quantize = 1,
+        .lod_threshold = 1.0f,
+        .lod_tile = 2,
+        .engine = ENGINE_TICK,
+        .spatial_index = SPATIAL_CHUNKREFS,
+        .collide_kernel = collide_kernel_detect(),
+        .pair_mode = PAIRS_ALL,
+        .collide_mode = COLLIDE_MODE_OVERLAP,
+        .cfl = 0.0f,
+        .dt_min = 0.0f,
+        .overlap_target = 0.05f,
+        .dt_log = "",
+        .reorder_interval = 0,
+        .reorder_threshold = 0.5f,
+        .autotune = 0,
+        .regrid_tolerance = 0.0f,
+        .skin = 0.5f,
+        .pressure_segments = 0,
+        .pressure_window = 100,
+        .pressure_history = 256,
+        .pressure_stream = "",
+        .virial_window = 0,
+        .virial_field = ""
+    };
+}
+
+
+static const ConfigKey* config_find(const char* key) {
+    for (uint32_t k = 0; k < CONFIG_KEYS_N; k++) {
+        if (strcmp(key, config_keys[k].key) == 0) {
+            return &config_keys[k];
+        }
+    }
+    return NULL;
+}
+
+
+// the whole value has to be consumed, "10k" or "0.1f" are errors and not 10 and 0.1
+static int parse_u32(const char* value, uint32_t* out) {
+    char* end;
+    errno = 0;
+    unsigned long v = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || value[0] == '-' || errno != 0 || v > UINT32_MAX) {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+
+static int parse_f32(const char* value, float* out) {
+    char* end;
+    errno = 0;
+    float v = strtof(value, &end);
+    if (end == value || *end != '\0' || errno != 0) {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+
+static int parse_name(const char* value, const char* (*to_name)(uint32_t), uint32_t counter, uint32_t* out) {
+    for (uint32_t k = 0; k < counter; k++) {
+        if (strcmp(value, to_name(k)) == 0) {
+            *out = k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static const char* index_name(uint32_t k) { return spatial_index_to_name(k); }
+static const char* kernel_name(uint32_t k) { return collide_kernel_to_name(k); }
+static const char* pairs_name(uint32_t k) { return pair_mode_to_name(k); }
+static const char* boundary_name(uint32_t k) { return boundary_to_name(k); }
+static const char* collide_name(uint32_t k) { return collide_mode_to_name(k); }
+static const char* engine_name(uint32_t k) { return engine_to_name(k); }
+static const char* pace_name(uint32_t k) { return pace_mode_to_name(k); }
+
+
+int config_set(Config* config, const char* key, const char* value) {
+    const ConfigKey* ck = config_find(key);
+    if (ck == NULL) {
+        fprintf(stderr, "ERROR: unknown config key '%s'\n", key);
+        return -1;
+    }
+    void* field = (char*) config + ck->offset;
+    int result = -1;
+    uint32_t k;
+    switch (ck->type) {
+    case CONFIG_U32: {
+        result = parse_u32(value, field);
+    } break;
+    case CONFIG_F32: {
+        result = parse_f32(value, field);
+    } break;
+    case CONFIG_INDEX: {
+        result = parse_name(value, index_name, SPATIAL_COUNTER, &k);
+        if (result == 0) *(SpatialIndex*) field = k;
+    } break;
+    case CONFIG_KERNEL: {
+        result = parse_name(value, kernel_name, COLLIDE_COUNTER, &k);
+        if (result == 0) *(CollideKernel*) field = k;
+    } break;
+    case CONFIG_PAIRS: {
+        result = parse_name(value, pairs_name, PAIRS_COUNTER, &k);
+        if (result == 0) *(PairMode*) field = k;
+    } break;
+    case CONFIG_BOUNDARY: {
+        result = parse_name(value, boundary_name, BOUNDARY_COUNTER, &k);
+        if (result == 0) *(Boundary*) field = k;
+    } break;
+    case CONFIG_COLLIDE: {
+        result = parse_name(value, collide_name, COLLIDE_MODE_COUNTER, &k);
+        if (result == 0) *(CollideMode*) field = k;
+    } break;
+    case CONFIG_ENGINE: {
+        result = parse_name(value, engine_name, ENGINE_COUNTER, &k);
+        if (result == 0) *(Engine*) field = k;
+    } break;
+    case CONFIG_PACE: {
+        result = parse_name(value, pace_name, PACE_COUNTER, &k);
+        if (result == 0) *(PaceMode*) field = k;
+    } break;
+    case CONFIG_PATH: {
+        if (strlen(value) < CONFIG_PATH_SIZE) {
+            strcpy(field, value);
+            result = 0;
+        }
+    } break;
+    }
+    if (result < 0) {
+        fprintf(stderr, "ERROR: invalid value '%s' for config key '%s' (%s)\n", value, key, ck->help);
+    }
+    return result;
+}
+
+
+static char* trim(char* s) {
+    while (isspace((unsigned char) *s)) s++;
+    char* end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+
+int config_load(Config* config, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: could not open config file '%s'\n", path);
+        return -1;
+    }
+    char line[512];
+    uint32_t line_n = 0;
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line_n++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char* s = trim(line);
+        if (*s == '\0') continue;
+        char* eq = strchr(s, '=');
+        if (eq == NULL) {
+            fprintf(stderr, "ERROR: %s:%d: expected 'key = value'\n", path, line_n);
+            result = -1;
+            break;
+        }
+        *eq = '\0';
+        if (config_set(config, trim(s), trim(eq + 1)) < 0) {
+            fprintf(stderr, "ERROR: %s:%d: invalid line\n", path, line_n);
+            result = -1;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+
+// --config <file>, --key <value> and --key=value, in order.
+// Returns 1 for -h/--help, the caller prints the usage.
+int config_parse_args(Config* config, int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            return 1;
+        }
+        if (strncmp(arg, "--", 2) != 0) {
+            fprintf(stderr, "ERROR: invalid argument '%s'\n", arg);
+            return -1;
+        }
+        char key[64];
+        const char* value;
+        const char* eq = strchr(arg, '=');
+        size_t key_len = eq != NULL ? (size_t)(eq - arg - 2) : strlen(arg + 2);
+        if (key_len == 0 || key_len >= sizeof(key)) {
+            fprintf(stderr, "ERROR: invalid argument '%s'\n", arg);
+            return -1;
+        }
+        memcpy(key, arg + 2, key_len);
+        key[key_len] = '\0';
+        if (eq != NULL) {
+            value = eq + 1;
+        } else if (i + 1 < argc) {
+            value = argv[++i];
+        } else {
+            fprintf(stderr, "ERROR: missing value for '%s'\n", arg);
+            return -1;
+        }
+        int result = strcmp(key, "config") == 0 ? config_load(config, value) : config_set(config, key, value);
+        if (result < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+void config_container(const Config* config, Container* container) {
+    container->width = config->width;
+    container->height = config->height;
+    container->zoom = config->zoom;
+    container->inverse_aspect_ratio = (float) container->height/container->width;
+    container->scalar = container->inverse_aspect_ratio * container->zoom;
+}
+
+
+// Reports every problem, not just the first, so a broken sweep entry is fixed in one go.
+int config_validate(const Config* config) {
+    int result = 0;
+    if (config->particles_n == 0 || !(config->particle_radius > 0.0f) || config->chunks_x == 0 || config->chunks_y == 0 || config->width == 0 || config->height == 0) {
+        fprintf(stderr, "ERROR: n, r, chunks and container size must be positive\n");
+        return -1;
+    }
+    if (!(config->dt > 0.0f) || !(config->zoom > 0.0f) || !(config->speed >= 0.0f)) {
+        fprintf(stderr, "ERROR: dt and zoom must be positive, speed must not be negative\n");
+        result = -1;
+    }
+    // a particle may straddle at most one chunk border per axis, see ChunkState
+    float chunk_w = (float) config->width / config->chunks_x;
+    float chunk_h = (float) config->height / config->chunks_y;
+    if (chunk_w < 2 * config->particle_radius || chunk_h < 2 * config->particle_radius) {
+        fprintf(stderr, "ERROR: chunks of %.2fx%.2f are smaller than a particle diameter of %.2f\n", chunk_w, chunk_h, 2 * config->particle_radius);
+        result = -1;
+    }
+    // see chunkmap_set_boundary, the cells are one diameter wide
+    if ((config->boundary_x == BOUNDARY_PERIODIC && (config->chunks_x < 3 || config->width < 6 * config->particle_radius)) ||
+        (config->boundary_y == BOUNDARY_PERIODIC && (config->chunks_y < 3 || config->height < 6 * config->particle_radius))) {
+        fprintf(stderr, "ERROR: a periodic axis needs at least 3 chunks and 3 particle diameters\n");
+        result = -1;
+    }
+    Container container;
+    config_container(config, &container);
+    uint32_t n_max = particles_n_max(&container, config->particle_radius);
+    if (config->particles_n > n_max) {
+        fprintf(stderr, "ERROR: too many particles %d for container %dx%d at r=%g, at most %d fit\n", config->particles_n, config->width, config->height, config->particle_radius, n_max);
+        result = -1;
+    }
+    if (!(config->reorder_threshold >= 0.0f && config->reorder_threshold <= 1.0f)) {
+        fprintf(stderr, "ERROR: reorder_threshold must be in 0..1\n");
+        result = -1;
+    }
+    if (!(config->regrid_tolerance == 0.0f || config->regrid_tolerance > 1.0f)) {
+        fprintf(stderr, "ERROR: regrid_tolerance must be 0 or above 1\n");
+        result = -1;
+    }
+    if (!(config->cfl >= 0.0f && config->cfl <= 1.0f)) {
+        fprintf(stderr, "ERROR: cfl must be in 0..1\n");
+        result = -1;
+    }
+    if (!(config->time_scale > 0.0f) || !(config->frame_budget > 0.0f)) {
+        fprintf(stderr, "ERROR: time_scale and frame_budget must be above 0\n");
+        result = -1;
+    }
+    if (!(config->lod_threshold >= 0.0f) || config->lod_tile == 0) {
+        fprintf(stderr, "ERROR: lod_threshold must not be negative and lod_tile must be positive\n");
+        result = -1;
+    }
+    if (!(config->dt_min >= 0.0f && config->dt_min <= config->dt) || !(config->overlap_target > 0.0f)) {
+        fprintf(stderr, "ERROR: dt_min must be in 0..dt and overlap_target above 0\n");
+        result = -1;
+    }
+    // see chunkmap_set_collide_mode, a swept particle reaches cfl radii further
+    if (config->collide_mode == COLLIDE_MODE_SWEPT) {
+        if (config->pair_mode != PAIRS_SYMMETRIC || config->cfl == 0.0f) {
+            fprintf(stderr, "ERROR: collide=swept needs pairs=symmetric and a cfl above 0\n");
+            result = -1;
+        }
+        if (chunk_w < 2 * config->particle_radius * (1 + config->cfl) || chunk_h < 2 * config->particle_radius * (1 + config->cfl)) {
+            fprintf(stderr, "ERROR: chunks of %.2fx%.2f are too small for swept collisions, they need %.2f\n", chunk_w, chunk_h, 2 * config->particle_radius * (1 + config->cfl));
+            result = -1;
+        }
+    }
+    if (!(config->skin >= 0.0f)) {
+        fprintf(stderr, "ERROR: skin must not be negative\n");
+        result = -1;
+    }
+    if (config->pressure_segments > 0 && (config->pressure_window == 0 || config->pressure_history == 0)) {
+        fprintf(stderr, "ERROR: pressure_window and pressure_history must be positive\n");
+        result = -1;
+    }
+    if (!collide_kernel_supported(config->collide_kernel)) {
+        fprintf(stderr, "ERROR: collision kernel '%s' is not supported by this cpu\n", collide_kernel_to_name(config->collide_kernel));
+        result = -1;
+    }
+    return result;
+}
+
+
+static void config_print_keys(const Config* config, FILE* out, bool help) {
+    for (uint32_t k = 0; k < CONFIG_KEYS_N; k++) {
+        const ConfigKey* ck = &config_keys[k];
+        const void* field = (const char*) config + ck->offset;
+        fprintf(out, "%-18s = ", ck->key);
+        switch (ck->type) {
+        case CONFIG_U32: {
+            fprintf(out, "%u", *(const uint32_t*) field);
+        } break;
+        case CONFIG_F32: {
+            fprintf(out, "%g", *(const float*) field);
+        } break;
+        case CONFIG_INDEX: {
+            fprintf(out, "%s", spatial_index_to_name(*(const SpatialIndex*) field));
+        } break;
+        case CONFIG_KERNEL: {
+            fprintf(out, "%s", collide_kernel_to_name(*(const CollideKernel*) field));
+        } break;
+        case CONFIG_PAIRS: {
+            fprintf(out, "%s", pair_mode_to_name(*(const PairMode*) field));
+        } break;
+        case CONFIG_BOUNDARY: {
+            fprintf(out, "%s", boundary_to_name(*(const Boundary*) field));
+        } break;
+        case CONFIG_COLLIDE: {
+            fprintf(out, "%s", collide_mode_to_name(*(const CollideMode*) field));
+        } break;
+        case CONFIG_ENGINE: {
+            fprintf(out, "%s", engine_to_name(*(const Engine*) field));
+        } break;
+        case CONFIG_PACE: {
+            fprintf(out, "%s", pace_mode_to_name(*(const PaceMode*) field));
+        } break;
+        case CONFIG_PATH: {
+            fprintf(out, "%s", (const char*) field);
+        } break;
+        }
+        if (help) {
+            fprintf(out, "  # %s", ck->help);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+
+// the output is itself a valid config file
+void config_print(const Config* config, FILE* out) {
+    config_print_keys(config, out, false);
+}
+
+
+void config_usage(const char* prog, FILE* out) {
+    Config defaults;
+    config_defaults(&defaults);
+    fprintf(out, "usage: %s [--config <file>] [--<key> <value>] [--<key>=<value>] ...\n", prog);
+    fprintf(out, "config files hold one 'key = value' per line, # starts a comment\n");
+    fprintf(out, "keys and their defaults:\n");
+    config_print_keys(&defaults, out, true);
+}
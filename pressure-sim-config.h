@@ -0,0 +1,84 @@
+#ifndef PS_CONFIG_H_
+#define PS_CONFIG_H_
+
+#include <stdio.h>
+#include "pressure-sim-physics.h"
+
+#define CONFIG_PATH_SIZE 256 // file name keys, including the terminator 
+
+// How the front end paces physics_tick against the wall clock. 
+typedef enum {
+    PACE_FRAME,    // one tick per presented frame, bound to the refresh rate 
+    PACE_REALTIME, // time_scale simulated seconds per wall clock second 
+    PACE_FAST,     // as many ticks as fit into the frame budget 
+    PACE_COUNTER
+} PaceMode;
+
+static inline const char* pace_mode_to_name(PaceMode pm) {
+    static const char *strings[] = { 
+        "frame", 
+        "realtime", 
+        "fast", 
+        "PACE_COUNTER"
+    };  
+    return strings[pm];
+}
+
+// Runtime parameters of a simulation run. Every field has a key, used both
+// as a command line flag (--key value, --key=value) and in config files
+// (one "key = value" per line, # starts a comment). Files and flags are
+// applied in the order they appear, so later ones override earlier ones.
+typedef struct {
+    uint32_t particles_n;       // n
+    float particle_radius;      // r
+    float speed;                // initial speed range
+    float dt;
+    uint32_t chunks_x;
+    uint32_t chunks_y;
+    uint32_t width;             // window and container size
+    uint32_t height;
+    Boundary boundary_x;        // left and right side
+    Boundary boundary_y;        // bottom and top side
+    float zoom;                 // container units to gpu coords
+    uint32_t seed;
+    uint32_t threads;           // physics threads, 0 = one per core
+    PaceMode pace;              // ticks per frame
+    float time_scale;           // simulated seconds per wall clock second, pace=realtime
+    float frame_budget;         // milliseconds of ticks between two render snapshots at most, pace=realtime and fast
+    uint32_t zero_copy;         // 1: the physics thread writes the positions straight into mapped upload buffers
+    uint32_t quantize;          // 1: positions go to the gpu as 16 bit unorm, GPUParticleQ16
+    float lod_threshold;        // particles per pixel from which the render draws a density grid instead of the particles, 0 = off
+    uint32_t lod_tile;          // pixels per density grid cell along each axis
+    Engine engine;              // tick or event driven
+    SpatialIndex spatial_index;
+    CollideKernel collide_kernel;
+    PairMode pair_mode;
+    CollideMode collide_mode;
+    float cfl;                  // dt cap in radii per tick for the fastest particle, 0 = fixed dt
+    float dt_min;               // adaptive dt between dt_min and dt, 0 = fixed dt
+    float overlap_target;       // deepest overlap per tick the adaptive dt aims for, in radii
+    char dt_log[CONFIG_PATH_SIZE];          // dt of every tick to this CSV file, empty = off 
+    uint32_t reorder_interval;  // Morton reorder every n ticks, 0 = off
+    float reorder_threshold;    // Morton reorder once the slot disorder passes this, 0 = off
+    uint32_t autotune;          // ticks timed per candidate chunk grid at startup, 0 = off
+    float regrid_tolerance;     // re-tune the chunk grid once the density changes by this factor, 0 = off
+    float skin;                 // verlet list skin 
+    uint32_t pressure_segments; // wall pressure segments per wall, 0 = off 
+    uint32_t pressure_window;   // ticks per wall pressure sample 
+    uint32_t pressure_history;  // wall pressure samples kept for the stats 
+    char pressure_stream[CONFIG_PATH_SIZE]; // wall pressure samples to this file, .csv or binary, empty = off 
+    uint32_t virial_window;     // ticks per virial stress sample, 0 = off 
+    char virial_field[CONFIG_PATH_SIZE];    // mean stress per chunk to this CSV file at exit, empty = off 
+} Config;
+
+
+void config_defaults(Config* config);
+int config_set(Config* config, const char* key, const char* value);
+int config_load(Config* config, const char* path);
+int config_parse_args(Config* config, int argc, char* argv[]);
+void config_container(const Config* config, Container* container);
+int config_validate(const Config* config);
+void config_print(const Config* config, FILE* out);
+void config_usage(const char* prog, FILE* out);
+
+#endif
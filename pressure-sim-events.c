@@ -0,0 +1,382 @@
+// Event driven molecular dynamics of hard disks (ENGINE_EVENTS).
+// Between two events a particle flies in a straight line, so instead of
+// moving everyone by dt and testing for overlaps, every slot predicts its
+// next event: the earliest collision with a disk in the 3x3 cells around it,
+// a wall bounce, or leaving its cell. A binary heap keyed on the event time
+// hands out the earliest event of all, which is processed exactly at its
+// time. Only the slots whose velocity changed predict again; a pair event
+// whose partner changed its velocity in the meantime is recognised by the
+// partner's collision count and dropped (lazy invalidation), the slot then
+// predicts again from its current state.
+// Every slot keeps its own clock and its position at that time in doubles,
+// events_advance writes the positions at the end of the tick back to the
+// particles, so rendering, the wall pressure and the virial read them like
+// after any other tick. The engine runs on the calling thread.
+#include "pressure-sim-physics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+// event_other codes, every value below the slot count is a pair event
+#define EVENT_NONE   UINT32_MAX         // flies forever, nothing ahead
+#define EVENT_WALL_X (UINT32_MAX - 1)   // bounces off the left or right wall
+#define EVENT_WALL_Y (UINT32_MAX - 2)
+#define EVENT_CELL_X (UINT32_MAX - 3)   // moves into the next cell column
+#define EVENT_CELL_Y (UINT32_MAX - 4)
+
+
+// min_image in doubles
+static inline double events_image(double d, double period) {
+    if (period > 0.0) {
+        if (d > 0.5 * period) d -= period;
+        else if (d < -0.5 * period) d += period;
+    }
+    return d;
+}
+
+
+// Moves the entry at heap index k to where its time belongs. The times sit
+// in the heap itself, so sifting does not chase the slots.
+static void events_heap_fix(Events* ev, uint32_t k) {
+    EventEntry e = ev->heap[k];
+    while (k > 0 && e.t < ev->heap[(k - 1) / 2].t) {
+        ev->heap[k] = ev->heap[(k - 1) / 2];
+        ev->heap_pos[ev->heap[k].slot] = k;
+        k = (k - 1) / 2;
+    }
+    for (;;) {
+        uint32_t l = 2 * k + 1, m = l;
+        if (l >= ev->n) break;
+        if (l + 1 < ev->n && ev->heap[l + 1].t < ev->heap[l].t) m = l + 1;
+        if (!(ev->heap[m].t < e.t)) break;
+        ev->heap[k] = ev->heap[m];
+        ev->heap_pos[ev->heap[k].slot] = k;
+        k = m;
+    }
+    ev->heap[k] = e;
+    ev->heap_pos[e.slot] = k;
+}
+
+
+static void events_cell_insert(Events* ev, uint32_t p, uint32_t c) {
+    ev->cell[p] = c;
+    ev->cell_prev[p] = UINT32_MAX;
+    ev->cell_next[p] = ev->cell_head[c];
+    if (ev->cell_head[c] != UINT32_MAX) ev->cell_prev[ev->cell_head[c]] = p;
+    ev->cell_head[c] = p;
+}
+
+
+static void events_cell_remove(Events* ev, uint32_t p) {
+    if (ev->cell_prev[p] != UINT32_MAX) ev->cell_next[ev->cell_prev[p]] = ev->cell_next[p];
+    else ev->cell_head[ev->cell[p]] = ev->cell_next[p];
+    if (ev->cell_next[p] != UINT32_MAX) ev->cell_prev[ev->cell_next[p]] = ev->cell_prev[p];
+}
+
+
+// flies p to time t, its velocity stays
+static inline void events_move(Events* ev, Particles* ps, uint32_t p, double t) {
+    ev->x[p] += ps->vx[p] * (t - ev->t[p]);
+    ev->y[p] += ps->vy[p] * (t - ev->t[p]);
+    ev->t[p] = t;
+}
+
+
+// time from now until two disks at separation (dx, dy) with relative
+// velocity (ux, uy) touch, INFINITY if they never do. Same root as collide_swept, a
+// pair that already overlaps and approaches collides right away.
+static inline double events_pair_time(double dx, double dy, double ux, double uy, double dr) {
+    double b = dx*ux + dy*uy;
+    if (b >= 0.0) {
+        return INFINITY; // moving apart
+    }
+    double c = dx*dx + dy*dy - dr*dr;
+    if (c <= 0.0) {
+        return 0.0;
+    }
+    double a = ux*ux + uy*uy;
+    double disc = b*b - a*c;
+    if (disc < 0.0) {
+        return INFINITY; // they pass each other
+    }
+    return c / (-b + sqrt(disc));
+}
+
+
+// Next event of p, which has been moved to its clock, the heap is updated
+// unless p is not in it yet.
+static void events_predict(Chunkmap* chunkmap, Events* ev, uint32_t p, bool in_heap) {
+    Particles* ps = &chunkmap->particles;
+    double now = ev->t[p];
+    double x = ev->x[p], y = ev->y[p];
+    double vx = ps->vx[p], vy = ps->vy[p];
+    double rad = ps->rad[p];
+    double period_x = ps->period_x, period_y = ps->period_y;
+    bool wrap_x = chunkmap->boundary_x == BOUNDARY_PERIODIC;
+    bool wrap_y = chunkmap->boundary_y == BOUNDARY_PERIODIC;
+    uint32_t cx = ev->cell[p] % ev->cells_x;
+    uint32_t cy = ev->cell[p] / ev->cells_x;
+    double best = INFINITY;
+    uint32_t other = EVENT_NONE;
+    uint32_t other_count = 0;
+
+    if (!wrap_x && vx != 0.0) {
+        double t = vx < 0.0 ? (rad - x) / vx : (chunkmap->dimensions.x - rad - x) / vx;
+        if (t < best) { best = t; other = EVENT_WALL_X; }
+    }
+    if (!wrap_y && vy != 0.0) {
+        double t = vy < 0.0 ? (rad - y) / vy : (chunkmap->dimensions.y - rad - y) / vy;
+        if (t < best) { best = t; other = EVENT_WALL_Y; }
+    }
+    if (vx > 0.0 && (wrap_x || cx + 1 < ev->cells_x)) {
+        double t = ((cx + 1) * ev->cell_w - x) / vx;
+        if (t < best) { best = t; other = EVENT_CELL_X; }
+    } else if (vx < 0.0 && (wrap_x || cx > 0)) {
+        double t = (cx * ev->cell_w - x) / vx;
+        if (t < best) { best = t; other = EVENT_CELL_X; }
+    }
+    if (vy > 0.0 && (wrap_y || cy + 1 < ev->cells_y)) {
+        double t = ((cy + 1) * ev->cell_h - y) / vy;
+        if (t < best) { best = t; other = EVENT_CELL_Y; }
+    } else if (vy < 0.0 && (wrap_y || cy > 0)) {
+        double t = (cy * ev->cell_h - y) / vy;
+        if (t < best) { best = t; other = EVENT_CELL_Y; }
+    }
+
+    // the 3x3 cells around p, wrapped along a periodic axis
+    for (int32_t dj = -1; dj <= 1; dj++) {
+        int32_t j = (int32_t) cy + dj;
+        if (j < 0 || j >= (int32_t) ev->cells_y) {
+            if (!wrap_y) continue;
+            j = j < 0 ? (int32_t) ev->cells_y - 1 : 0;
+        }
+        for (int32_t di = -1; di <= 1; di++) {
+            int32_t i = (int32_t) cx + di;
+            if (i < 0 || i >= (int32_t) ev->cells_x) {
+                if (!wrap_x) continue;
+                i = i < 0 ? (int32_t) ev->cells_x - 1 : 0;
+            }
+            for (uint32_t q = ev->cell_head[(uint32_t) j * ev->cells_x + i]; q != UINT32_MAX; q = ev->cell_next[q]) {
+                if (q == p) continue;
+                double dtq = now - ev->t[q];
+                double dx = events_image(ev->x[q] + ps->vx[q]*dtq - x, period_x);
+                double dy = events_image(ev->y[q] + ps->vy[q]*dtq - y, period_y);
+                double t = events_pair_time(dx, dy, ps->vx[q] - vx, ps->vy[q] - vy, rad + ps->rad[q]);
+                if (t < best) {
+                    best = t;
+                    other = q;
+                    other_count = ev->count[q];
+                }
+            }
+        }
+    }
+
+    ev->event_other[p] = other;
+    ev->event_count[p] = other_count;
+    if (in_heap) {
+        ev->heap[ev->heap_pos[p]].t = now + new_max(best, 0.0);
+        events_heap_fix(ev, ev->heap_pos[p]);
+    } else {
+        ev->heap[p] = (EventEntry) { now + new_max(best, 0.0), p };
+        ev->heap_pos[p] = p;
+    }
+}
+
+
+// elastic hard disk collision of p and q, both moved to the contact time
+static void events_collide(Chunkmap* chunkmap, Events* ev, uint32_t p, uint32_t q) {
+    Particles* ps = &chunkmap->particles;
+    double dx = events_image(ev->x[p] - ev->x[q], ps->period_x);
+    double dy = events_image(ev->y[p] - ev->y[q], ps->period_y);
+    double d = sqrt(dx*dx + dy*dy);
+    if (d == 0.0) {
+        return;
+    }
+    double nx = dx / d, ny = dy / d;
+    double un = (ps->vx[p] - ps->vx[q])*nx + (ps->vy[p] - ps->vy[q])*ny;
+    if (un >= 0.0) {
+        return;
+    }
+    // momentum p gets along n, q gets the opposite
+    double j = -2.0 * ps->mass[p] * ps->mass[q] / (ps->mass[p] + ps->mass[q]) * un;
+    VirialRow* vr = virial_row(chunkmap, 0);
+    if (vr != NULL) {
+        double dr = ps->rad[p] + ps->rad[q];
+        virial_add(vr, ev->x[q] + 0.5*dx, ev->y[q] + 0.5*dy, nx*dr, ny*dr, j*nx, j*ny);
+    }
+    ps->vx[p] += j / ps->mass[p] * nx;
+    ps->vy[p] += j / ps->mass[p] * ny;
+    ps->vx[q] -= j / ps->mass[q] * nx;
+    ps->vy[q] -= j / ps->mass[q] * ny;
+    ev->count[p]++;
+    ev->count[q]++;
+    ev->collisions++;
+}
+
+
+void events_free(Events* ev) {
+    free(ev->cell_head);
+    free(ev->cell_next);
+    free(ev->cell_prev);
+    free(ev->cell);
+    free(ev->x);
+    free(ev->y);
+    free(ev->t);
+    free(ev->event_other);
+    free(ev->event_count);
+    free(ev->count);
+    free(ev->heap);
+    free(ev->heap_pos);
+    *ev = (Events) { 0 };
+}
+
+
+// Fresh state from the particles at chunkmap->time. The cells are at least
+// one particle diameter wide, so a collision partner is always in the 3x3
+// cells. Past that they are half the mean particle spacing: smaller cells
+// only add crossings in a dilute gas, larger ones make every prediction scan
+// crowded cells wherever the gas is denser than the mean.
+static int events_build(Chunkmap* chunkmap, float particle_radius) {
+    Events* ev = &chunkmap->events;
+    Particles* ps = &chunkmap->particles;
+    uint32_t n = chunkmap->particles_n;
+    float side = new_max(2 * particle_radius, 0.5f * sqrtf(chunkmap->dimensions.x * chunkmap->dimensions.y / new_max(n, 1)));
+    uint32_t cells_x = new_max((uint32_t)(chunkmap->dimensions.x / side), 1);
+    uint32_t cells_y = new_max((uint32_t)(chunkmap->dimensions.y / side), 1);
+    // a periodic axis needs three distinct columns (rows) in the 3x3 cells,
+    // chunkmap_set_boundary made sure they are still a diameter wide
+    if (chunkmap->boundary_x == BOUNDARY_PERIODIC) cells_x = new_max(cells_x, 3);
+    if (chunkmap->boundary_y == BOUNDARY_PERIODIC) cells_y = new_max(cells_y, 3);
+    if (ev->n != n || ev->cells_x != cells_x || ev->cells_y != cells_y) {
+        events_free(ev);
+        size_t cells = (size_t) cells_x * cells_y;
+        ev->cell_head = malloc(cells * sizeof ev->cell_head[0]);
+        ev->cell_next = malloc(n * sizeof ev->cell_next[0]);
+        ev->cell_prev = malloc(n * sizeof ev->cell_prev[0]);
+        ev->cell = malloc(n * sizeof ev->cell[0]);
+        ev->x = malloc(n * sizeof ev->x[0]);
+        ev->y = malloc(n * sizeof ev->y[0]);
+        ev->t = malloc(n * sizeof ev->t[0]);
+        ev->event_other = malloc(n * sizeof ev->event_other[0]);
+        ev->event_count = malloc(n * sizeof ev->event_count[0]);
+        ev->count = malloc(n * sizeof ev->count[0]);
+        ev->heap = malloc(n * sizeof ev->heap[0]);
+        ev->heap_pos = malloc(n * sizeof ev->heap_pos[0]);
+        if (ev->cell_head == NULL || ev->cell_next == NULL || ev->cell_prev == NULL || ev->cell == NULL ||
+            ev->x == NULL || ev->y == NULL || ev->t == NULL || ev->event_other == NULL ||
+            ev->event_count == NULL || ev->count == NULL || ev->heap == NULL || ev->heap_pos == NULL) {
+            fprintf(stderr, "ERROR: malloc of event driven state (%d particles, %zu cells) failed.\n", n, cells);
+            events_free(ev);
+            return -1;
+        }
+        ev->n = n;
+        ev->cells_x = cells_x;
+        ev->cells_y = cells_y;
+    }
+    ev->cell_w = (double) chunkmap->dimensions.x / cells_x;
+    ev->cell_h = (double) chunkmap->dimensions.y / cells_y;
+    memset(ev->cell_head, 0xff, (size_t) cells_x * cells_y * sizeof ev->cell_head[0]);
+    memset(ev->count, 0, n * sizeof ev->count[0]);
+    for (uint32_t p = 0; p < n; p++) {
+        ev->x[p] = ps->x[p];
+        ev->y[p] = ps->y[p];
+        ev->t[p] = chunkmap->time;
+        int32_t i = (int32_t) floor(ev->x[p] / ev->cell_w);
+        int32_t j = (int32_t) floor(ev->y[p] / ev->cell_h);
+        i = i < 0 ? 0 : i >= (int32_t) cells_x ? (int32_t) cells_x - 1 : i;
+        j = j < 0 ? 0 : j >= (int32_t) cells_y ? (int32_t) cells_y - 1 : j;
+        events_cell_insert(ev, p, (uint32_t) j * cells_x + i);
+    }
+    for (uint32_t p = 0; p < n; p++) {
+        events_predict(chunkmap, ev, p, false);
+    }
+    for (uint32_t k = n / 2; k-- > 0;) {
+        events_heap_fix(ev, k);
+    }
+    ev->events = 0;
+    ev->collisions = 0;
+    ev->invalid = 0;
+    ev->stale = false;
+    return 0;
+}
+
+
+// p leaves its cell through the side its velocity points at
+static void events_cross(Events* ev, Particles* ps, uint32_t p, bool along_x) {
+    uint32_t cx = ev->cell[p] % ev->cells_x;
+    uint32_t cy = ev->cell[p] / ev->cells_x;
+    if (along_x) {
+        if (ps->vx[p] > 0.0f) {
+            cx = cx + 1 < ev->cells_x ? cx + 1 : 0;
+            ev->x[p] = cx * ev->cell_w; // exactly on the side, no drift into the old cell
+        } else {
+            cx = cx > 0 ? cx - 1 : ev->cells_x - 1;
+            ev->x[p] = (cx + 1) * ev->cell_w;
+        }
+    } else {
+        if (ps->vy[p] > 0.0f) {
+            cy = cy + 1 < ev->cells_y ? cy + 1 : 0;
+            ev->y[p] = cy * ev->cell_h;
+        } else {
+            cy = cy > 0 ? cy - 1 : ev->cells_y - 1;
+            ev->y[p] = (cy + 1) * ev->cell_h;
+        }
+    }
+    events_cell_remove(ev, p);
+    events_cell_insert(ev, p, cy * ev->cells_x + cx);
+}
+
+
+// Processes every event up to chunkmap->time + dt and leaves the particles
+// at that time. A bounce is counted in the wall pressure row of thread 0.
+int events_advance(Chunkmap* chunkmap, float dt, float particle_radius) {
+    Events* ev = &chunkmap->events;
+    Particles* ps = &chunkmap->particles;
+    WallPressure* wp = &chunkmap->pressure;
+    if ((ev->stale || ev->n != chunkmap->particles_n) && events_build(chunkmap, particle_radius) < 0) {
+        return -1;
+    }
+    double end = chunkmap->time + dt;
+    while (ev->n > 0 && ev->heap[0].t <= end) {
+        uint32_t p = ev->heap[0].slot;
+        double t = ev->heap[0].t;
+        uint32_t other = ev->event_other[p];
+        ev->events++;
+        events_move(ev, ps, p, t);
+        if (other < ev->n) {
+            if (ev->count[other] != ev->event_count[p]) {
+                ev->invalid++; // the partner took another path since
+            } else {
+                events_move(ev, ps, other, t);
+                events_collide(chunkmap, ev, p, other);
+                events_predict(chunkmap, ev, other, true);
+            }
+        } else if (other == EVENT_WALL_X) {
+            bool left = ps->vx[p] < 0.0f;
+            if (wp->segments > 0) wall_impulse(wp, 0, left ? WALL_LEFT : WALL_RIGHT, ev->y[p] / chunkmap->dimensions.y, 2.0f * ps->mass[p] * fabsf(ps->vx[p]));
+            ev->x[p] = left ? ps->rad[p] : chunkmap->dimensions.x - ps->rad[p];
+            ps->vx[p] *= -1.0f;
+            ev->count[p]++;
+        } else if (other == EVENT_WALL_Y) {
+            bool bottom = ps->vy[p] < 0.0f;
+            if (wp->segments > 0) wall_impulse(wp, 0, bottom ? WALL_BOTTOM : WALL_TOP, ev->x[p] / chunkmap->dimensions.x, 2.0f * ps->mass[p] * fabsf(ps->vy[p]));
+            ev->y[p] = bottom ? ps->rad[p] : chunkmap->dimensions.y - ps->rad[p];
+            ps->vy[p] *= -1.0f;
+            ev->count[p]++;
+        } else if (other == EVENT_CELL_X || other == EVENT_CELL_Y) {
+            events_cross(ev, ps, p, other == EVENT_CELL_X);
+        }
+        events_predict(chunkmap, ev, p, true);
+    }
+    // positions at the end of the tick, the slot clocks stay where they are
+    for (uint32_t p = 0; p < ev->n; p++) {
+        float x = (float)(ev->x[p] + ps->vx[p] * (end - ev->t[p]));
+        float y = (float)(ev->y[p] + ps->vy[p] * (end - ev->t[p]));
+        if (ps->period_x > 0.0f) x = x < 0.0f ? x + ps->period_x : x >= ps->period_x ? x - ps->period_x : x;
+        if (ps->period_y > 0.0f) y = y < 0.0f ? y + ps->period_y : y >= ps->period_y ? y - ps->period_y : y;
+        ps->x[p] = x;
+        ps->y[p] = y;
+    }
+    return 0;
+}
@@ -0,0 +1,2785 @@
+#include "pressure-sim-physics.h"
+#include "pressure-sim-render.h"
+#include <stdlib.h> 
+#include <stdio.h> 
+#include <string.h> 
+#include <math.h> 
+#include <time.h> 
+
+/* #define DEBUG */ 
+
+
+static inline Box particle_box(Particles* ps, uint32_t p) {
+    return (Box) { 
+        .l = ps->x[p] - ps->rad[p], 
+        .r = ps->x[p] + ps->rad[p], 
+        .b = ps->y[p] - ps->rad[p], 
+        .t = ps->y[p] + ps->rad[p] 
+    }; 
+}
+
+
+float rand_float(float min, float max) {
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+
+void particle_print(Particles* ps, uint32_t p, const char* prefix) { 
+    printf("%sp->id:%d\n", prefix, ps->id[p]);
+    char buf[10000] = ""; 
+    char* cur = buf, * const end = buf + sizeof buf; 
+    for (uint32_t i = 0; i < 4; i++) {
+        if (end <= cur) {
+            fprintf(stderr, "particle_print: not enough memory.\n");
+            abort(); 
+        }
+        if (ps->chunk_refs[p][i].chunk) {
+            cur += snprintf(cur, end-cur, 
+                "\n%s\t%d (%d,%d)@%p p_index=%d,free=%d,filled=%d", 
+                prefix, i, ps->chunk_refs[p][i].chunk->x, ps->chunk_refs[p][i].chunk->y, (void*)ps->chunk_refs[p][i].chunk, ps->chunk_refs[p][i].p_index, ps->chunk_refs[p][i].chunk->particles_free, ps->chunk_refs[p][i].chunk->particles_filled);
+        }
+    }
+    printf("%sp->chunk_refs: [%s\n%s]\n", prefix, buf, prefix); 
+    printf("%sp->chunk_state:%s\n", prefix, chunkstate_to_name(ps->chunk_state[p]));
+    printf("%sp->box:%f %f %f %f\n", prefix, ps->x[p] - ps->rad[p], ps->x[p] + ps->rad[p], ps->y[p] + ps->rad[p], ps->y[p] - ps->rad[p]);
+    printf("%sp->p:%f %f\n", prefix, ps->x[p], ps->y[p]);
+}
+
+
+
+bool chunk_ref_is_valid(ChunkRef* chunk_ref) {
+    return chunk_ref->chunk->particles_filled > chunk_ref->p_index; 
+}
+
+
+uint32_t chunk_append(Chunk* chunk, uint32_t p) {
+#ifdef DEBUG
+    printf("chunk_append %d,%d@%p\n", chunk->x, chunk->y, (void*)chunk);
+    if (chunk->particles_free == 0) {
+        fprintf(stderr, "ERROR: appending to full chunk"); 
+        abort(); 
+    }
+#endif // DEBUG
+    uint32_t p_index = chunk->particles_filled; 
+    chunk->particles[p_index] = p; 
+    chunk->particles_filled++;
+    chunk->particles_free--; 
+    return p_index; 
+} 
+
+
+void chunk_pop(Particles* ps, ChunkRef* chunk_ref) {
+#ifdef DEBUG 
+    printf("chunk_pop (%d,%d) @ %p\n", chunk_ref->chunk->x, chunk_ref->chunk->y, (void*)chunk_ref->chunk);
+    if (chunk_ref->chunk->particles_filled == 0) {
+        printf("Can't pop empty chunk. exiting.\n"); 
+        abort(); 
+    }
+    if (!chunk_ref_is_valid(chunk_ref)) {
+        printf("chunk_pop invalid chunk_ref. exiting.\n"); 
+        printf("chunk_pop (%d,%d) @ %p\n", chunk_ref->chunk->x, chunk_ref->chunk->y, (void*)chunk_ref->chunk);
+        abort(); 
+    }
+#endif // DEBUG 
+    uint32_t last_index = chunk_ref->chunk->particles_filled - 1; 
+    if (last_index != chunk_ref->p_index) {
+        bool double_ref = false; 
+        for (uint32_t k = 0; k < 4; k++) {
+            ChunkRef* other_chunk_ref = &ps->chunk_refs[chunk_ref->chunk->particles[last_index]][k];
+            if (other_chunk_ref->chunk && other_chunk_ref->chunk == chunk_ref->chunk && other_chunk_ref->p_index == last_index) {
+                if (double_ref) {
+                    fprintf(stderr, "Double ref!\n");
+                }
+                other_chunk_ref->p_index = chunk_ref->p_index;  
+                chunk_ref->chunk->particles[chunk_ref->p_index] = chunk_ref->chunk->particles[last_index]; 
+                double_ref = true; 
+            }
+        }
+
+    }
+    chunk_ref->chunk->particles[last_index] = UINT32_MAX; 
+    chunk_ref->chunk->particles_filled--; 
+    chunk_ref->chunk->particles_free++; 
+    chunk_ref->chunk = NULL; 
+}
+
+
+void chunkmap_print(Chunkmap* chunkmap, const char* prefix) {
+    printf("-- Chunkmap -- \n"); 
+    printf("%schunks@%p\n", prefix, (void*)chunkmap->chunks); 
+    printf("%schunks_count:(%d,%d)\n", prefix, chunkmap->chunks_x, chunkmap->chunks_y); 
+    printf("%schunks_size:(%f,%f)\n", prefix, vec2_unpack(chunkmap->chunks_size)); 
+    printf("%sdimensions:(%f,%f)\n", prefix, vec2_unpack(chunkmap->dimensions)); 
+    printf("%sparticles_max_per_chunk:%d\n", prefix, chunkmap->particles_max_per_chunk); 
+    printf("%sparticles.x@%p\n", prefix, (void*)chunkmap->particles.x); 
+    printf("%sparticles_n:%d\n", prefix, chunkmap->particles_n); 
+    for (uint32_t i = 0; i < chunkmap->chunks_x; i++) {
+        for (uint32_t j = 0; j < chunkmap->chunks_y; j++) {
+            if (chunkmap->chunks[i][j]->particles_filled > 0) { 
+                printf("%s %d,%d@%p free=%d filled=%d\n", prefix, i, j, (void*)chunkmap->chunks[i][j], chunkmap->chunks[i][j]->particles_free, chunkmap->chunks[i][j]->particles_filled);
+            }
+        }
+    }
+    printf("------------- \n"); 
+}
+
+
+typedef struct Stack { 
+    ChunkRef stack[10]; 
+    uint32_t size; 
+    uint32_t capacity; 
+} Stack; 
+
+
+void particle_remove_chunkref(Particles* ps, uint32_t p, uint32_t i) {
+    if (ps->chunk_refs[p][i].chunk != NULL) {
+        chunk_pop(ps, &ps->chunk_refs[p][i]);
+        ps->chunk_refs[p][i].chunk = NULL; 
+    }
+}
+
+void particle_set_chunkref(Particles* ps, uint32_t p, uint32_t i, Chunk* chunk) {
+#ifdef DEBUG
+    if (chunk == NULL) {
+        printf("particle_set_chunk to NULL!\n"); 
+        abort(); 
+    }
+#endif // DEBUG 
+    ps->chunk_refs[p][i].chunk = chunk; 
+    ps->chunk_refs[p][i].p_index = chunk_append(chunk, p); 
+}
+
+
+void particle_update_chunkref(Particles* ps, uint32_t p, uint32_t i, Chunk* chunk) {
+    if (ps->chunk_refs[p][i].chunk == NULL) {}
+    else if (ps->chunk_refs[p][i].chunk != chunk) {
+        chunk_pop(ps, &ps->chunk_refs[p][i]);
+    } else return; 
+    particle_set_chunkref(ps, p, i, chunk); 
+}
+
+
+bool particle_chunkrefs_is_null(Particles* ps, uint32_t p) {
+    for (uint32_t i = 0; i < 4; i++) {
+        if (ps->chunk_refs[p][i].chunk != NULL) {
+            return false;
+        } 
+    }
+    return true;
+} 
+
+
+// Moves p into the chunks of state, want holds them in the ref slots of that 
+// state: 
+//   CS_ONE:  0 
+//   CS_LR:   0 left, 1 right 
+//   CS_TB:   2 top, 3 bottom 
+//   CS_LRTB: 0 bottom right, 1 top right, 2 top left, 3 bottom left 
+// Only the difference to the current chunks touches the chunk lists. A chunk 
+// p stays in keeps its list entry, the ref just moves to its new slot. 
+void particle_set_chunks(Particles* ps, uint32_t p, ChunkState state, Chunk* const want[4], MembershipStats* stats) {
+    ChunkRef old[4]; 
+    memcpy(old, ps->chunk_refs[p], sizeof old); 
+    for (uint32_t k = 0; k < 4; k++) {
+        ps->chunk_refs[p][k].chunk = NULL; 
+    }
+    for (uint32_t d = 0; d < 4; d++) {
+        for (uint32_t k = 0; want[d] != NULL && k < 4; k++) {
+            if (old[k].chunk == want[d]) {
+                ps->chunk_refs[p][d] = old[k]; 
+                old[k].chunk = NULL; 
+            }
+        }
+    }
+    // the pops fix up the refs of the particle swapped into the hole, that 
+    // is never p, p has one ref per chunk 
+    for (uint32_t k = 0; k < 4; k++) {
+        if (old[k].chunk != NULL) {
+            chunk_pop(ps, &old[k]); 
+            stats->pops++; 
+        }
+    }
+    for (uint32_t d = 0; d < 4; d++) {
+        if (want[d] != NULL && ps->chunk_refs[p][d].chunk == NULL) {
+            particle_set_chunkref(ps, p, d, want[d]); 
+            stats->appends++; 
+        }
+    }
+    ps->chunk_state[p] = state; 
+#ifdef DEBUG
+    for (uint32_t d = 0; d < 4; d++) {
+        if (ps->chunk_refs[p][d].chunk != want[d]) {
+            particle_print(ps, p, "?? "); 
+            abort(); 
+        }
+    }
+#endif // DEBUG
+}
+
+
+// vr collects the virial of the velocity exchange, NULL = off 
+void collide(Particles* ps, uint32_t p1, uint32_t p2, VirialRow* vr) {
+    float dx = min_image(ps->x[p1] - ps->x[p2], ps->period_x);
+    float dy = min_image(ps->y[p1] - ps->y[p2], ps->period_y);
+    float dr = ps->rad[p1] + ps->rad[p2]; 
+    if (dx*dx + dy*dy <= dr*dr*1.000f) {
+        float inv_sqrt = 1.0f/sqrt(dx*dx + dy*dy);
+        if (vr != NULL) {
+            virial_add(vr, ps->x[p2] + 0.5f*dx, ps->y[p2] + 0.5f*dy, dx, dy, ps->mass[p1]*(ps->vx[p2] - ps->vx[p1]), ps->mass[p1]*(ps->vy[p2] - ps->vy[p1])); 
+        }
+        float tmp_x = ps->vx[p1]; 
+        float tmp_y = ps->vy[p1]; 
+        ps->vx[p1] = ps->vx[p2]; 
+        ps->vy[p1] = ps->vy[p2]; 
+        ps->vx[p2] = tmp_x; 
+        ps->vy[p2] = tmp_y; 
+        float alpha = 1.0f*(dr*inv_sqrt-1.0f);
+        alpha *= 1.1f; 
+        ps->dpos_x[p1] += alpha*dx;  
+        ps->dpos_y[p1] += alpha*dy;  
+        ps->overlap[p1] = new_max(ps->overlap[p1], dr - (dx*dx + dy*dy)*inv_sqrt); 
+        /* ps->dpos_x[p2] += -alpha*dx; */  
+        /* ps->dpos_y[p2] += -alpha*dy; */  
+    }
+}
+
+
+// Response for pair loops that visit every pair once: the velocities are 
+// swapped and both particles are pushed apart, which conserves momentum. 
+void collide_symmetric(Particles* ps, uint32_t p1, uint32_t p2, VirialRow* vr) {
+    float dx = min_image(ps->x[p1] - ps->x[p2], ps->period_x);
+    float dy = min_image(ps->y[p1] - ps->y[p2], ps->period_y);
+    float dr = ps->rad[p1] + ps->rad[p2]; 
+    if (dx*dx + dy*dy <= dr*dr*1.000f) {
+        float inv_sqrt = 1.0f/sqrt(dx*dx + dy*dy);
+        if (vr != NULL) {
+            virial_add(vr, ps->x[p2] + 0.5f*dx, ps->y[p2] + 0.5f*dy, dx, dy, ps->mass[p1]*(ps->vx[p2] - ps->vx[p1]), ps->mass[p1]*(ps->vy[p2] - ps->vy[p1])); 
+        }
+        float tmp_x = ps->vx[p1]; 
+        float tmp_y = ps->vy[p1]; 
+        ps->vx[p1] = ps->vx[p2]; 
+        ps->vy[p1] = ps->vy[p2]; 
+        ps->vx[p2] = tmp_x; 
+        ps->vy[p2] = tmp_y; 
+        float alpha = 1.0f*(dr*inv_sqrt-1.0f);
+        alpha *= 1.1f; 
+        ps->dpos_x[p1] += alpha*dx;  
+        ps->dpos_y[p1] += alpha*dy;  
+        ps->dpos_x[p2] -= alpha*dx;  
+        ps->dpos_y[p2] -= alpha*dy;  
+        float depth = dr - (dx*dx + dy*dy)*inv_sqrt; 
+        ps->overlap[p1] = new_max(ps->overlap[p1], depth); 
+        ps->overlap[p2] = new_max(ps->overlap[p2], depth); 
+    }
+}
+
+
+// Swept response for pair loops that visit every pair once. t is the time 
+// of impact within the tick, from the positions at its start and the 
+// current velocities. At t the velocities are exchanged along the contact 
+// normal (elastic hard disks), and the moves are corrected so that both 
+// particles travel with the old velocity until t and with the new one 
+// after it. A pair that already overlaps and still approaches collides at 
+// t = 0. 
+void collide_swept(Particles* ps, uint32_t p1, uint32_t p2, VirialRow* vr) {
+    float dt = ps->sweep_dt; 
+    float dx = min_image(ps->x[p1] - ps->x[p2], ps->period_x);
+    float dy = min_image(ps->y[p1] - ps->y[p2], ps->period_y);
+    float ux = ps->vx[p1] - ps->vx[p2]; 
+    float uy = ps->vy[p1] - ps->vy[p2]; 
+    float b = dx*ux + dy*uy; 
+    if (b >= 0.0f) {
+        return; // moving apart 
+    }
+    float dr = ps->rad[p1] + ps->rad[p2]; 
+    float c = dx*dx + dy*dy - dr*dr; 
+    float t = 0.0f; 
+    if (c > 0.0f) {
+        float a = ux*ux + uy*uy; 
+        float disc = b*b - a*c; 
+        if (disc < 0.0f) {
+            return; // they pass each other 
+        }
+        // smaller root of a*t^2 + 2*b*t + c, written without the cancellation 
+        t = c / (-b + sqrtf(disc)); 
+        if (t > dt) {
+            return; 
+        }
+    }
+    float nx = dx + ux*t; 
+    float ny = dy + uy*t; 
+    float n2 = nx*nx + ny*ny; 
+    if (n2 == 0.0f) {
+        return; 
+    }
+    float inv_n = 1.0f/sqrtf(n2); 
+    nx *= inv_n; 
+    ny *= inv_n; 
+    float un = ux*nx + uy*ny; 
+    if (un >= 0.0f) {
+        return; 
+    }
+    // momentum p1 gets along n, positive, p2 gets the opposite 
+    float j = -2.0f * ps->mass[p1] * ps->mass[p2] / (ps->mass[p1] + ps->mass[p2]) * un; 
+    if (vr != NULL) {
+        virial_add(vr, ps->x[p2] + 0.5f*dx, ps->y[p2] + 0.5f*dy, nx*dr, ny*dr, j*nx, j*ny); 
+    }
+    float dv1 = j / ps->mass[p1]; 
+    float dv2 = j / ps->mass[p2]; 
+    float rest = dt - t; 
+    ps->vx[p1] += dv1*nx; 
+    ps->vy[p1] += dv1*ny; 
+    ps->vx[p2] -= dv2*nx; 
+    ps->vy[p2] -= dv2*ny; 
+    ps->dpos_x[p1] += dv1*nx*rest;  
+    ps->dpos_y[p1] += dv1*ny*rest;  
+    ps->dpos_x[p2] -= dv2*nx*rest;  
+    ps->dpos_y[p2] -= dv2*ny*rest;  
+}
+
+
+void particle_collisions(CollideKernel kernel, Particles* ps, uint32_t p, ChunkRef chunk_ref, VirialRow* vr) {
+    // p itself is in the list at p_index, collide_list skips it 
+    collide_list(kernel, ps, p, chunk_ref.chunk->particles, chunk_ref.chunk->particles_filled, vr);
+}
+
+
+// v moved at most one period out of [0, period), back into it 
+static inline float wrap_periodic(float v, float period) {
+    if (v < 0.0f) {
+        v += period; 
+        return v < period ? v : 0.0f; // -tiny + period rounds to period 
+    }
+    return v >= period ? v - period : v; 
+}
+
+
+// Reflects p off the container walls. On a wall hit *i (*j) is set to the 
+// column (row) of the wall chunk, otherwise it is left untouched. thread is 
+// the pool thread running p, it picks the row of the wall pressure. Along a 
+// periodic axis p is wrapped back into the container instead. With swept 
+// collisions a bounce anywhere within the tick mirrors the start of the 
+// step at the contact plane, so the step ends where the reflected path does. 
+static inline void particle_walls(Chunkmap* chunkmap, Particles* ps, uint32_t p, float particle_radius, uint32_t thread, uint32_t* i, uint32_t* j) {
+    float border_pad = 0.1f; 
+    WallPressure* wp = &chunkmap->pressure; 
+    if (chunkmap->boundary_x == BOUNDARY_PERIODIC) {
+        ps->x[p] = wrap_periodic(ps->x[p], chunkmap->dimensions.x); 
+    } else if (ps->sweep_dt > 0.0f) {
+        float x_end = ps->x[p] + ps->vx[p]*ps->sweep_dt; 
+        if (ps->vx[p] < 0.0f && x_end - particle_radius <= 0.0f) {
+            if (wp->segments > 0) wall_impulse(wp, thread, WALL_LEFT, ps->y[p] / chunkmap->dimensions.y, -2.0f * ps->mass[p] * ps->vx[p]); 
+            ps->vx[p] *= -1.0f; 
+            ps->x[p] = 2.0f*particle_radius - ps->x[p]; 
+        } else if (ps->vx[p] > 0.0f && x_end + particle_radius >= chunkmap->dimensions.x) {
+            if (wp->segments > 0) wall_impulse(wp, thread, WALL_RIGHT, ps->y[p] / chunkmap->dimensions.y, 2.0f * ps->mass[p] * ps->vx[p]); 
+            ps->vx[p] *= -1.0f; 
+            ps->x[p] = 2.0f*(chunkmap->dimensions.x - particle_radius) - ps->x[p]; 
+        }
+    } else if (ps->x[p] - particle_radius <= 0.0f) { 
+        if (wp->segments > 0) wall_impulse(wp, thread, WALL_LEFT, ps->y[p] / chunkmap->dimensions.y, -2.0f * ps->mass[p] * ps->vx[p]); 
+        ps->vx[p] *= -1.0f; 
+        ps->x[p] = 0.0f + particle_radius + border_pad; 
+        *i = 0; 
+    } else if (ps->x[p] + particle_radius >= chunkmap->dimensions.x) {
+        if (wp->segments > 0) wall_impulse(wp, thread, WALL_RIGHT, ps->y[p] / chunkmap->dimensions.y, 2.0f * ps->mass[p] * ps->vx[p]); 
+        ps->vx[p] *= -1.0f; 
+        ps->x[p] = chunkmap->dimensions.x - particle_radius - border_pad; 
+        *i = chunkmap->chunks_x - 1; 
+    }
+    if (chunkmap->boundary_y == BOUNDARY_PERIODIC) {
+        ps->y[p] = wrap_periodic(ps->y[p], chunkmap->dimensions.y); 
+    } else if (ps->sweep_dt > 0.0f) {
+        float y_end = ps->y[p] + ps->vy[p]*ps->sweep_dt; 
+        if (ps->vy[p] < 0.0f && y_end - particle_radius <= 0.0f) {
+            if (wp->segments > 0) wall_impulse(wp, thread, WALL_BOTTOM, ps->x[p] / chunkmap->dimensions.x, -2.0f * ps->mass[p] * ps->vy[p]); 
+            ps->vy[p] *= -1.0f; 
+            ps->y[p] = 2.0f*particle_radius - ps->y[p]; 
+        } else if (ps->vy[p] > 0.0f && y_end + particle_radius >= chunkmap->dimensions.y) {
+            if (wp->segments > 0) wall_impulse(wp, thread, WALL_TOP, ps->x[p] / chunkmap->dimensions.x, 2.0f * ps->mass[p] * ps->vy[p]); 
+            ps->vy[p] *= -1.0f; 
+            ps->y[p] = 2.0f*(chunkmap->dimensions.y - particle_radius) - ps->y[p]; 
+        }
+    } else if (ps->y[p] - particle_radius <= 0.0f) {
+        if (wp->segments > 0) wall_impulse(wp, thread, WALL_BOTTOM, ps->x[p] / chunkmap->dimensions.x, -2.0f * ps->mass[p] * ps->vy[p]); 
+        ps->vy[p] *= -1.0f; 
+        ps->y[p] = 0.0f + particle_radius + border_pad; 
+        *j = 0; 
+    } else if (ps->y[p] + particle_radius >= chunkmap->dimensions.y) {
+        if (wp->segments > 0) wall_impulse(wp, thread, WALL_TOP, ps->x[p] / chunkmap->dimensions.x, 2.0f * ps->mass[p] * ps->vy[p]); 
+        ps->vy[p] *= -1.0f; 
+        ps->y[p] = chunkmap->dimensions.y - particle_radius - border_pad; 
+        *j = chunkmap->chunks_y - 1; 
+    }
+    if (chunkmap->dt_control.enabled) {
+        DtRow* row = &chunkmap->dt_control.rows[thread]; 
+        row->v2_max = new_max(row->v2_max, ps->vx[p]*ps->vx[p] + ps->vy[p]*ps->vy[p]); 
+        row->overlap_max = new_max(row->overlap_max, ps->overlap[p]); 
+        ps->overlap[p] = 0.0f; 
+    }
+}
+
+
+// The chunk range of p: (i,j) is the bottom left chunk and state says whether 
+// p also reaches into the chunk to the right and/or on top. i/j come in as 
+// UINT32_MAX, or as the wall chunk if particle_walls pinned p to a wall. 
+// Along a periodic axis a p on the seam starts in the last column (row) and 
+// reaches into the first one, the ghost membership that lets it collide with 
+// the particles on the other side. 
+static inline void particle_chunk_range(Chunkmap* chunkmap, Particles* ps, uint32_t p, float particle_radius, uint32_t i, uint32_t j, uint32_t* i_out, uint32_t* j_out, ChunkState* state) {
+    bool lambda_cond = i != UINT32_MAX; 
+    bool mu_cond = j != UINT32_MAX; 
+    
+    if (!lambda_cond && chunkmap->boundary_x == BOUNDARY_PERIODIC) {
+        float lambda = (ps->x[p] - particle_radius)/chunkmap->chunks_size.x; 
+        int32_t lambda_floor = floorf(lambda); 
+        lambda_cond = lambda > lambda_floor && lambda + 2*particle_radius/chunkmap->chunks_size.x < lambda_floor+1; 
+        if (lambda_floor < 0) lambda_floor += chunkmap->chunks_x; 
+        else if (lambda_floor >= (int32_t) chunkmap->chunks_x) lambda_floor -= chunkmap->chunks_x; 
+        i = lambda_floor; 
+    } else if (!lambda_cond) {
+        float lambda = (ps->x[p] - particle_radius)/chunkmap->chunks_size.x; 
+        if (lambda < 0.0f) lambda = 0.0f; // a swept extent reaches past the wall 
+        uint32_t lambda_floor = floorf(lambda); 
+        /* lambda_cond = lambda > lambda_floor && lambda < lambda_floor + 1 - 2 * particle_radius; */
+        lambda_cond = lambda > lambda_floor && lambda + 2*particle_radius/chunkmap->chunks_size.x < lambda_floor+1; 
+        i = lambda_floor; 
+        if (i >= chunkmap->chunks_x - 1) { // rounding near the wall, there is no chunk to the right 
+            lambda_cond = true; 
+            i = chunkmap->chunks_x - 1; 
+        }
+    }
+    if (!mu_cond && chunkmap->boundary_y == BOUNDARY_PERIODIC) {
+        float mu = (ps->y[p] - particle_radius)/chunkmap->chunks_size.y; 
+        int32_t mu_floor = floorf(mu); 
+        mu_cond = mu > mu_floor && mu + 2*particle_radius/chunkmap->chunks_size.y < mu_floor+1; 
+        if (mu_floor < 0) mu_floor += chunkmap->chunks_y; 
+        else if (mu_floor >= (int32_t) chunkmap->chunks_y) mu_floor -= chunkmap->chunks_y; 
+        j = mu_floor; 
+    } else if (!mu_cond) {
+        float mu = (ps->y[p] - particle_radius)/chunkmap->chunks_size.y; 
+        if (mu < 0.0f) mu = 0.0f; 
+        uint32_t mu_floor = floorf(mu); 
+        // mu_cond = mu > mu_floor && mu < mu_floor + 1 - 2 * particle_radius;
+        mu_cond = mu > mu_floor && mu + 2*particle_radius/chunkmap->chunks_size.y < mu_floor+1; 
+        j = mu_floor; 
+        if (j >= chunkmap->chunks_y - 1) { // rounding near the wall, there is no chunk on top 
+            mu_cond = true; 
+            j = chunkmap->chunks_y - 1; 
+        }
+    }
+    *i_out = i; 
+    *j_out = j; 
+    if (lambda_cond && mu_cond) *state = CS_ONE; 
+    else if (lambda_cond && !mu_cond) *state = CS_TB; 
+    else if (!lambda_cond && mu_cond) *state = CS_LR; 
+    else *state = CS_LRTB; 
+}
+
+
+// Walls plus the chunk range of p. Swept collisions widen the range by the 
+// sweep margin, two particles that can meet within the tick share a chunk. 
+static inline void particle_chunk_target(Chunkmap* chunkmap, Particles* ps, uint32_t p, float particle_radius, uint32_t thread, uint32_t* i_out, uint32_t* j_out, ChunkState* state) {
+    uint32_t i = UINT32_MAX, j = UINT32_MAX;
+    particle_walls(chunkmap, ps, p, particle_radius, thread, &i, &j); 
+    particle_chunk_range(chunkmap, ps, p, particle_radius + chunkmap->sweep_margin, i, j, i_out, j_out, state); 
+}
+
+
+// The bottom left chunk of p, see particle_set_chunks for the ref slots. 
+static inline Chunk* particle_home_chunk(Particles* ps, uint32_t p) {
+    switch (ps->chunk_state[p]) {
+    case CS_ONE: 
+    case CS_LR: return ps->chunk_refs[p][0].chunk; 
+    case CS_TB: 
+    case CS_LRTB: return ps->chunk_refs[p][3].chunk; 
+    default: return NULL; 
+    }
+}
+
+
+static inline void particle_chunk_apply(Chunkmap* chunkmap, Particles* ps, uint32_t p, uint32_t i, uint32_t j, ChunkState state) {
+    Chunk* chunk = chunkmap->chunks[i][j]; // bottom left 
+    if (ps->chunk_state[p] == state && particle_home_chunk(ps, p) == chunk) {
+        return; // same home and state, same chunks 
+    }
+    Chunk* want[4] = { NULL, NULL, NULL, NULL }; 
+    switch (state) {
+    case CS_ONE: {
+        want[0] = chunk; 
+    } break; 
+    case CS_TB: {
+        want[2] = chunk->top; 
+        want[3] = chunk; 
+    } break; 
+    case CS_LR: {
+        want[0] = chunk; 
+        want[1] = chunk->right; 
+    } break; 
+    case CS_LRTB: {
+        want[0] = chunk->right; 
+        want[1] = chunk->right->top; 
+        want[2] = chunk->top; 
+        want[3] = chunk; 
+    } break; 
+    default: {
+        fprintf(stderr, "invalid chunk state\n");
+        return; 
+    } break; 
+    }
+    particle_set_chunks(ps, p, state, want, &chunkmap->membership); 
+}
+
+
+static inline void particle_step(CollideKernel kernel, Particles* ps, uint32_t p, float dt, VirialRow* vr) {
+    ps->dpos_x[p] = ps->vx[p]*dt; 
+    ps->dpos_y[p] = ps->vy[p]*dt; 
+
+    switch(ps->chunk_state[p]) {
+    case CS_ONE: {
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][0], vr);     
+    } break; 
+    case CS_LR: {
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][0], vr);     
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][1], vr);     
+    } break; 
+    case CS_TB: {
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][2], vr);     
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][3], vr);     
+    } break; 
+    case CS_LRTB: {
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][0], vr);     
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][1], vr);     
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][2], vr);     
+        particle_collisions(kernel, ps, p, ps->chunk_refs[p][3], vr);     
+    } break; 
+    default: {
+        fprintf(stderr, "invalid chunk state\n");
+    } break; 
+    }
+    ps->x[p] += ps->dpos_x[p];  
+    ps->y[p] += ps->dpos_y[p];  
+}
+
+
+// A pair that shares more than one chunk is seen in each of them, only the 
+// shared chunk with the lowest address owns it. Chunks are laid out 
+// column by column, so that is the bottom left one. 
+static inline bool pair_owned_by(Particles* ps, uint32_t p, uint32_t q, Chunk* chunk) {
+    if (ps->chunk_state[p] == CS_ONE || ps->chunk_state[q] == CS_ONE) {
+        return true; 
+    }
+    for (uint32_t r = 0; r < 4; r++) {
+        Chunk* shared = ps->chunk_refs[p][r].chunk; 
+        if (shared == NULL || shared >= chunk) continue; 
+        for (uint32_t s = 0; s < 4; s++) {
+            if (ps->chunk_refs[q][s].chunk == shared) {
+                return false; 
+            }
+        }
+    }
+    return true; 
+}
+
+
+// Symmetric pairs of one chunk: particles[a] against particles[a+1..]. 
+static void chunk_pairs(CollideKernel kernel, Particles* ps, Chunk* chunk, VirialRow* vr) {
+    uint32_t hits[COLLIDE_BLOCK];
+    for (uint32_t a = 0; a < chunk->particles_filled; a++) {
+        uint32_t p = chunk->particles[a]; 
+        if (ps->sweep_dt > 0.0f) {
+            // the overlap kernels would drop the pairs that only meet later in the tick 
+            for (uint32_t b = a + 1; b < chunk->particles_filled; b++) {
+                if (pair_owned_by(ps, p, chunk->particles[b], chunk)) {
+                    collide_swept(ps, p, chunk->particles[b], vr); 
+                }
+            }
+            continue; 
+        }
+        for (uint32_t base = a + 1; base < chunk->particles_filled; base += COLLIDE_BLOCK) {
+            uint32_t block = chunk->particles_filled - base < COLLIDE_BLOCK ? chunk->particles_filled - base : COLLIDE_BLOCK;
+            uint32_t hits_n = collide_hits(kernel, ps, p, chunk->particles + base, block, hits); 
+            for (uint32_t h = 0; h < hits_n; h++) {
+                if (pair_owned_by(ps, p, hits[h], chunk)) {
+                    collide_symmetric(ps, p, hits[h], vr); 
+                }
+            }
+        }
+    }
+}
+
+
+// PAIRS_JACOBI: the contacts of a tick only read the state of the previous 
+// tick and every particle only writes its own columns. 
+// 1. every particle sums the pushes of all its contacts into dpos and picks 
+//    the deepest contact as its partner 
+// 2. two particles that picked each other swap velocities, like in collide, 
+//    and everyone moves by dpos. With the virial on the move is a phase of 
+//    its own, the swap reads the position of the partner. 
+// A particle swaps with at most one other per tick, so the swaps are a 
+// permutation of the velocities and energy and momentum stay exact. Contacts 
+// left over get their swap in a later tick if they still overlap. The pushes 
+// are summed in 32.32 fixed point, integer sums are exact in any order, so 
+// the result does not depend on the slot order, the chunk list order or the 
+// thread count. 
+typedef enum {
+    JACOBI_CONTACTS, 
+    JACOBI_APPLY, 
+    JACOBI_MOVE, 
+    JACOBI_COUNTER
+} JacobiPhase; 
+
+
+typedef struct {
+    int64_t dpos_x, dpos_y; 
+    uint32_t partner; 
+    float partner_depth; 
+} JacobiSum; 
+
+
+// Cells c - reach .. c + reach along an axis of cells cells, as at most two 
+// half open ranges. Clamped at walls. Wrapped around a periodic axis, where 
+// a reach that goes all the way around still lists every cell only once. 
+typedef struct {
+    uint32_t begin[2], end[2]; 
+    uint32_t n; 
+} CellSpan; 
+
+
+static inline CellSpan cell_span(uint32_t c, uint32_t reach, uint32_t cells, bool wrap) {
+    CellSpan span = { .n = 1 }; 
+    if (!wrap) {
+        span.begin[0] = c < reach ? 0 : c - reach; 
+        span.end[0] = c + reach >= cells ? cells : c + reach + 1; 
+    } else if (2 * reach + 1 >= cells) {
+        span.begin[0] = 0; 
+        span.end[0] = cells; 
+    } else if (c < reach) {
+        span.n = 2; 
+        span.begin[0] = c + cells - reach; 
+        span.end[0] = cells; 
+        span.begin[1] = 0; 
+        span.end[1] = c + reach + 1; 
+    } else if (c + reach >= cells) {
+        span.n = 2; 
+        span.begin[0] = c - reach; 
+        span.end[0] = cells; 
+        span.begin[1] = 0; 
+        span.end[1] = c + reach + 1 - cells; 
+    } else {
+        span.begin[0] = c - reach; 
+        span.end[0] = c + reach + 1; 
+    }
+    return span; 
+}
+
+
+// truncates, which is symmetric around 0, so mirrored pushes stay mirrored 
+static inline int64_t jacobi_fixed(float v) {
+    return (int64_t)(v * 0x1p32f); 
+}
+
+
+static inline float jacobi_float(int64_t v) {
+    return (float)((double) v * 0x1p-32); 
+}
+
+
+// Push of p out of its overlap with q, as in collide. q gets the mirrored 
+// push in its own pass, bit for bit. The deepest overlap is p's partner, ties 
+// go to the lower id, which does not change when the slots are reordered. 
+static inline void collide_jacobi(Particles* ps, uint32_t p, uint32_t q, JacobiSum* sum) {
+    float dx = min_image(ps->x[p] - ps->x[q], ps->period_x);
+    float dy = min_image(ps->y[p] - ps->y[q], ps->period_y);
+    float dr = ps->rad[p] + ps->rad[q]; 
+    float d2 = dx*dx + dy*dy; 
+    if (d2 > dr*dr*1.000f || d2 == 0.0f) {
+        return; 
+    }
+    float inv_sqrt = 1.0f/sqrt(d2);
+    float alpha = 1.0f*(dr*inv_sqrt-1.0f);
+    alpha *= 1.1f; 
+    sum->dpos_x += jacobi_fixed(alpha*dx); 
+    sum->dpos_y += jacobi_fixed(alpha*dy); 
+    ps->overlap[p] = new_max(ps->overlap[p], dr - d2*inv_sqrt); 
+    float depth = dr*dr - d2; 
+    if (sum->partner == UINT32_MAX || depth > sum->partner_depth || (depth == sum->partner_depth && ps->id[q] < ps->id[sum->partner])) {
+        sum->partner = q; 
+        sum->partner_depth = depth; 
+    }
+}
+
+
+// Contacts of p in others. chunk is the chunk the list belongs to, NULL for 
+// the cell and verlet lists. A pair that shares more than one chunk only 
+// counts in the one that owns it. 
+static inline void jacobi_list(CollideKernel kernel, Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, Chunk* chunk, JacobiSum* sum) {
+    uint32_t hits[COLLIDE_BLOCK];
+    for (uint32_t base = 0; base < n; base += COLLIDE_BLOCK) {
+        uint32_t block = n - base < COLLIDE_BLOCK ? n - base : COLLIDE_BLOCK;
+        uint32_t hits_n = collide_hits(kernel, ps, p, others + base, block, hits); 
+        for (uint32_t h = 0; h < hits_n; h++) {
+            if (hits[h] != p && (chunk == NULL || pair_owned_by(ps, p, hits[h], chunk))) {
+                collide_jacobi(ps, p, hits[h], sum); 
+            }
+        }
+    }
+}
+
+
+// Phase 1 for the k-th particle of the spatial index: slot order for the 
+// chunk refs, cell list order for the cell and verlet lists. 
+static inline void particle_jacobi(Chunkmap* chunkmap, uint32_t k, float dt) {
+    Particles* ps = &chunkmap->particles; 
+    Celllist* cl = &chunkmap->celllist; 
+    CollideKernel kernel = chunkmap->collide_kernel; 
+    uint32_t p = chunkmap->spatial_index == SPATIAL_CHUNKREFS ? k : cl->cell_particles[k]; 
+    JacobiSum sum = { .partner = UINT32_MAX }; 
+    switch (chunkmap->spatial_index) {
+    case SPATIAL_CHUNKREFS: {
+        for (uint32_t r = 0; r < 4; r++) {
+            Chunk* chunk = ps->chunk_refs[p][r].chunk; 
+            if (chunk == NULL) continue; 
+            jacobi_list(kernel, ps, p, chunk->particles, chunk->particles_filled, chunk, &sum); 
+        }
+    } break; 
+    case SPATIAL_CELLLIST: {
+        uint32_t key = cl->particle_cell[p]; 
+        CellSpan rows = cell_span(key / cl->cells_x, 1, cl->cells_y, cl->wrap_y); 
+        CellSpan columns = cell_span(key % cl->cells_x, 1, cl->cells_x, cl->wrap_x); 
+        for (uint32_t r = 0; r < rows.n; r++) {
+            for (uint32_t j = rows.begin[r]; j < rows.end[r]; j++) {
+                for (uint32_t c = 0; c < columns.n; c++) {
+                    uint32_t begin = cl->cell_start[j * cl->cells_x + columns.begin[c]]; 
+                    uint32_t end = cl->cell_start[j * cl->cells_x + columns.end[c]]; 
+                    jacobi_list(kernel, ps, p, cl->cell_particles + begin, end - begin, NULL, &sum); 
+                }
+            }
+        }
+    } break; 
+    case SPATIAL_VERLET: {
+        Verlet* vl = &chunkmap->verlet; 
+        jacobi_list(kernel, ps, p, vl->neighbours + vl->start[k], vl->start[k + 1] - vl->start[k], NULL, &sum); 
+    } break; 
+    default: break; 
+    }
+    ps->dpos_x[p] = ps->vx[p]*dt + jacobi_float(sum.dpos_x); 
+    ps->dpos_y[p] = ps->vy[p]*dt + jacobi_float(sum.dpos_y); 
+    ps->partner[p] = sum.partner; 
+}
+
+
+// Phase 2 for slot p. A matched pair is swapped by its lower id, so every 
+// pair is written by exactly one particle. The move is left to JACOBI_MOVE 
+// while vr is set. 
+static inline void particle_jacobi_apply(Particles* ps, uint32_t p, VirialRow* vr) {
+    uint32_t q = ps->partner[p]; 
+    if (q != UINT32_MAX && ps->partner[q] == p && ps->id[p] < ps->id[q]) {
+        if (vr != NULL) {
+            float dx = min_image(ps->x[p] - ps->x[q], ps->period_x); 
+            float dy = min_image(ps->y[p] - ps->y[q], ps->period_y); 
+            virial_add(vr, ps->x[q] + 0.5f*dx, ps->y[q] + 0.5f*dy, dx, dy, ps->mass[p]*(ps->vx[q] - ps->vx[p]), ps->mass[p]*(ps->vy[q] - ps->vy[p])); 
+        }
+        float tmp_x = ps->vx[p]; 
+        float tmp_y = ps->vy[p]; 
+        ps->vx[p] = ps->vx[q]; 
+        ps->vy[p] = ps->vy[q]; 
+        ps->vx[q] = tmp_x; 
+        ps->vy[q] = tmp_y; 
+    }
+    if (vr == NULL) {
+        ps->x[p] += ps->dpos_x[p];  
+        ps->y[p] += ps->dpos_y[p];  
+    }
+}
+
+
+typedef struct {
+    Chunkmap* chunkmap; 
+    float dt; 
+    uint32_t slots_per_task; 
+    JacobiPhase phase; 
+} JacobiJob; 
+
+
+static void jacobi_job(void* ctx, uint32_t task, uint32_t thread) {
+    JacobiJob* job = ctx; 
+    Chunkmap* chunkmap = job->chunkmap; 
+    uint32_t begin = task * job->slots_per_task; 
+    uint32_t end = begin + job->slots_per_task; 
+    if (end > chunkmap->particles_n) end = chunkmap->particles_n; 
+    Particles* ps = &chunkmap->particles; 
+    VirialRow* vr = virial_row(chunkmap, thread); 
+    for (uint32_t k = begin; k < end; k++) {
+        switch (job->phase) {
+        case JACOBI_CONTACTS: {
+            particle_jacobi(chunkmap, k, job->dt); 
+        } break; 
+        case JACOBI_APPLY: {
+            particle_jacobi_apply(ps, k, vr); 
+        } break; 
+        case JACOBI_MOVE: {
+            ps->x[k] += ps->dpos_x[k];  
+            ps->y[k] += ps->dpos_y[k];  
+        } break; 
+        default: break; 
+        }
+    }
+}
+
+
+// Both phases of PAIRS_JACOBI, once the spatial index is up to date. Phase 1 
+// writes nothing another particle reads and phase 2 writes disjoint pairs, 
+// so any split over the threads works. 
+static int physics_jacobi(float dt, Chunkmap* chunkmap) {
+    Threadpool* pool = chunkmap->threadpool; 
+    JacobiJob job = {
+        .chunkmap = chunkmap, 
+        .dt = dt, 
+        .slots_per_task = 4096, 
+    }; 
+    uint32_t tasks = (chunkmap->particles_n + job.slots_per_task - 1) / job.slots_per_task; 
+    for (job.phase = JACOBI_CONTACTS; job.phase < JACOBI_COUNTER; job.phase++) {
+        if (job.phase == JACOBI_MOVE && !chunkmap->virial.enabled) continue; 
+        if (pool != NULL) {
+            threadpool_run(pool, jacobi_job, &job, tasks); 
+        } else {
+            for (uint32_t t = 0; t < tasks; t++) {
+                jacobi_job(&job, t, 0); 
+            }
+        }
+    }
+    return 0; 
+}
+
+
+// FIXME: Redo chunk tracking, it's bad
+// - ChunkState okay 
+// - Use binary search to account for big jumps 
+// - split the grid into groups of chunks to search
+// 
+// other option (worse, but easier to implement): 
+// - rerun chunk_overlap over groups of chunks 
+static int physics_tick_chunkrefs(float dt, Chunkmap* chunkmap, float particle_radius) {
+    Particles* ps = &chunkmap->particles; 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        uint32_t i, j; 
+        ChunkState state; 
+        particle_chunk_target(chunkmap, ps, p, particle_radius, 0, &i, &j, &state); 
+        particle_chunk_apply(chunkmap, ps, p, i, j, state); 
+        if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+            ps->dpos_x[p] = ps->vx[p]*dt; 
+            ps->dpos_y[p] = ps->vy[p]*dt; 
+        } else if (chunkmap->pair_mode == PAIRS_ALL) {
+            particle_step(chunkmap->collide_kernel, ps, p, dt, virial_row(chunkmap, 0)); 
+        }
+    }
+    if (chunkmap->pair_mode == PAIRS_JACOBI) {
+        return physics_jacobi(dt, chunkmap); 
+    }
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        for (uint32_t i = 0; i < chunkmap->chunks_x; i++) {
+            for (uint32_t j = 0; j < chunkmap->chunks_y; j++) {
+                chunk_pairs(chunkmap->collide_kernel, ps, chunkmap->chunks[i][j], virial_row(chunkmap, 0)); 
+            }
+        }
+        for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+            ps->x[p] += ps->dpos_x[p];  
+            ps->y[p] += ps->dpos_y[p];  
+        }
+    }
+    return 0;
+}
+
+
+// Parallel tick over the chunk grid. 
+// 1. walls and chunk targets, split by particle slot. A particle whose 
+//    chunks change goes into the migration buffer of its thread. 
+// 2. the migrations are applied on one thread, chunk_pop/chunk_append 
+//    touch chunks and particles all over the place. 
+// 3. collisions and integration, split by home chunk (bottom left). p 
+//    writes itself and the particles it shares a chunk with, their home 
+//    chunks are at most one chunk away. With a 3x3 checkerboard the 
+//    chunks of one colour are 3 apart, so they never touch the same particle. 
+//    Around a periodic seam that needs a column (row) count divisible by 3, 
+//    the 1 or 2 columns (rows) left over next to the seam get colours of 
+//    their own, see colour_line. 
+//    In PAIRS_SYMMETRIC the pairs run per chunk instead (they only touch 
+//    particles of that chunk) and the integration is a 4th pass by slot. 
+typedef struct {
+    Chunkmap* chunkmap; 
+    float dt; 
+    float particle_radius; 
+    uint32_t slots_per_task; 
+    uint32_t colour; 
+    uint32_t class_x, class_y; // colour classes of the current colour along x and y, see colour_line 
+    uint32_t lines_x;          // chunk columns of class_x 
+    uint32_t rows_per_band; 
+    uint32_t bands; 
+    uint32_t colours;          // band colours, 3 when an odd number of bands wraps around 
+
+    atomic_uint disp2_max; // SPATIAL_VERLET: bits of the largest squared displacement, see tick_job_walls 
+} TickJob; 
+
+
+static void migration_push(MigrationBuffer* buffer, Migration migration) {
+    if (buffer->n == buffer->capacity) {
+        uint32_t capacity = new_max(2 * buffer->capacity, 1024); 
+        Migration* items = realloc(buffer->items, capacity * sizeof items[0]); 
+        if (items == NULL) {
+            fprintf(stderr, "ERROR: realloc of migration buffer (%d) failed.\n", capacity);
+            abort(); 
+        }
+        buffer->items = items; 
+        buffer->capacity = capacity; 
+    }
+    buffer->items[buffer->n++] = migration; 
+}
+
+
+static void tick_job_targets(void* ctx, uint32_t task, uint32_t thread) {
+    TickJob* job = ctx; 
+    Chunkmap* chunkmap = job->chunkmap; 
+    Particles* ps = &chunkmap->particles; 
+    MigrationBuffer* buffer = &chunkmap->migrations[thread]; 
+    uint32_t begin = task * job->slots_per_task; 
+    uint32_t end = begin + job->slots_per_task; 
+    if (end > chunkmap->particles_n) end = chunkmap->particles_n; 
+    for (uint32_t p = begin; p < end; p++) {
+        uint32_t i, j; 
+        ChunkState state; 
+        particle_chunk_target(chunkmap, ps, p, job->particle_radius, thread, &i, &j, &state); 
+        ps->dpos_x[p] = ps->vx[p]*job->dt; 
+        ps->dpos_y[p] = ps->vy[p]*job->dt; 
+        Chunk* home = particle_home_chunk(ps, p); 
+        if (home == NULL || home->x != i || home->y != j || ps->chunk_state[p] != state) {
+            migration_push(buffer, (Migration) { .p = p, .i = i, .j = j, .state = state }); 
+        }
+    }
+}
+
+
+static void tick_job_integrate(void* ctx, uint32_t task, uint32_t thread) {
+    TickJob* job = ctx; 
+    Chunkmap* chunkmap = job->chunkmap; 
+    Particles* ps = &chunkmap->particles; 
+    uint32_t begin = task * job->slots_per_task; 
+    uint32_t end = begin + job->slots_per_task; 
+    if (end > chunkmap->particles_n) end = chunkmap->particles_n; 
+    for (uint32_t p = begin; p < end; p++) {
+        ps->x[p] += ps->dpos_x[p];  
+        ps->y[p] += ps->dpos_y[p];  
+    }
+}
+
+
+// Colour classes along an axis of n chunk columns (rows): class c < 3 holds 
+// the columns c, c + 3, ... of the part whose length is divisible by 3, on a 
+// periodic axis the leftover columns next to the seam are a class each. 
+static inline uint32_t colour_classes(uint32_t n, bool wrap) {
+    return wrap ? 3 + n % 3 : 3; 
+}
+
+
+static inline uint32_t colour_lines(uint32_t n, bool wrap, uint32_t c) {
+    uint32_t n3 = wrap ? n - n % 3 : n; 
+    if (c >= 3) return 1; 
+    return n3 > c ? (n3 - c + 2) / 3 : 0; 
+}
+
+
+// t-th column (row) of class c 
+static inline uint32_t colour_line(uint32_t n, bool wrap, uint32_t c, uint32_t t) {
+    uint32_t n3 = wrap ? n - n % 3 : n; 
+    return c < 3 ? c + 3 * t : n3 + c - 3; 
+}
+
+
+static void tick_job_chunks(void* ctx, uint32_t task, uint32_t thread) {
+    TickJob* job = ctx; 
+    Chunkmap* chunkmap = job->chunkmap; 
+    Particles* ps = &chunkmap->particles; 
+    uint32_t i = colour_line(chunkmap->chunks_x, chunkmap->boundary_x == BOUNDARY_PERIODIC, job->class_x, task % job->lines_x); 
+    uint32_t j = colour_line(chunkmap->chunks_y, chunkmap->boundary_y == BOUNDARY_PERIODIC, job->class_y, task / job->lines_x); 
+    Chunk* chunk = chunkmap->chunks[i][j]; 
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        chunk_pairs(chunkmap->collide_kernel, ps, chunk, virial_row(chunkmap, thread)); 
+        return; 
+    }
+    for (uint32_t k = 0; k < chunk->particles_filled; k++) {
+        uint32_t p = chunk->particles[k]; 
+        if (particle_home_chunk(ps, p) == chunk) {
+            particle_step(chunkmap->collide_kernel, ps, p, job->dt, virial_row(chunkmap, thread)); 
+        }
+    }
+}
+
+
+static int physics_tick_chunkrefs_threaded(float dt, Chunkmap* chunkmap, float particle_radius) {
+    Threadpool* pool = chunkmap->threadpool; 
+    TickJob job = {
+        .chunkmap = chunkmap, 
+        .dt = dt, 
+        .particle_radius = particle_radius, 
+        .slots_per_task = 4096, 
+    }; 
+    for (uint32_t t = 0; t < pool->threads; t++) {
+        chunkmap->migrations[t].n = 0; 
+    }
+    threadpool_run(pool, tick_job_targets, &job, (chunkmap->particles_n + job.slots_per_task - 1) / job.slots_per_task); 
+    for (uint32_t t = 0; t < pool->threads; t++) {
+        MigrationBuffer* buffer = &chunkmap->migrations[t]; 
+        for (uint32_t m = 0; m < buffer->n; m++) {
+            Migration* migration = &buffer->items[m]; 
+            particle_chunk_apply(chunkmap, &chunkmap->particles, migration->p, migration->i, migration->j, migration->state); 
+        }
+    }
+    if (chunkmap->pair_mode == PAIRS_JACOBI) {
+        return physics_jacobi(dt, chunkmap); 
+    }
+    bool wrap_x = chunkmap->boundary_x == BOUNDARY_PERIODIC; 
+    bool wrap_y = chunkmap->boundary_y == BOUNDARY_PERIODIC; 
+    for (job.class_y = 0; job.class_y < colour_classes(chunkmap->chunks_y, wrap_y); job.class_y++) {
+        for (job.class_x = 0; job.class_x < colour_classes(chunkmap->chunks_x, wrap_x); job.class_x++) {
+            job.lines_x = colour_lines(chunkmap->chunks_x, wrap_x, job.class_x); 
+            uint32_t lines_y = colour_lines(chunkmap->chunks_y, wrap_y, job.class_y); 
+            threadpool_run(pool, tick_job_chunks, &job, job.lines_x * lines_y); 
+        }
+    }
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        threadpool_run(pool, tick_job_integrate, &job, (chunkmap->particles_n + job.slots_per_task - 1) / job.slots_per_task); 
+    }
+    return 0;
+}
+
+
+static inline uint32_t celllist_key(Celllist* cl, float x, float y) {
+    uint32_t i = (uint32_t) new_max(x / cl->cell_size.x, 0.0f); 
+    uint32_t j = (uint32_t) new_max(y / cl->cell_size.y, 0.0f); 
+    if (i >= cl->cells_x) i = cl->cells_x - 1; 
+    if (j >= cl->cells_y) j = cl->cells_y - 1; 
+    return j * cl->cells_x + i; 
+}
+
+
+// Counting sort of the particle slots by cell: key pass, prefix sum over the 
+// cells, scatter. Afterwards the slots of cell c are 
+// cell_particles[cell_start[c] .. cell_start[c+1]). 
+void celllist_build(Chunkmap* chunkmap) {
+    Celllist* cl = &chunkmap->celllist; 
+    Particles* ps = &chunkmap->particles; 
+    uint32_t n_cells = cl->cells_x * cl->cells_y; 
+    memset(cl->cell_start, 0, (n_cells + 1) * sizeof cl->cell_start[0]); 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        uint32_t key = celllist_key(cl, ps->x[p], ps->y[p]); 
+        cl->particle_cell[p] = key; 
+        cl->cell_start[key + 1]++; 
+    }
+    for (uint32_t c = 0; c < n_cells; c++) {
+        cl->cell_start[c + 1] += cl->cell_start[c]; 
+    }
+    memcpy(cl->cell_fill, cl->cell_start, n_cells * sizeof cl->cell_fill[0]); 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        cl->cell_particles[cl->cell_fill[cl->particle_cell[p]]++] = p; 
+    }
+}
+
+
+// Same update as physics_tick_chunkrefs, but the neighbours come from a cell 
+// list that is rebuilt from scratch every tick. A particle is binned by its 
+// center and tested against the 3x3 cells around it, which needs cells at 
+// least one particle diameter wide. 
+static inline void particle_step_celllist(CollideKernel kernel, Particles* ps, Celllist* cl, uint32_t p, float dt, VirialRow* vr) {
+    ps->dpos_x[p] = ps->vx[p]*dt; 
+    ps->dpos_y[p] = ps->vy[p]*dt; 
+
+    uint32_t key = cl->particle_cell[p]; 
+    CellSpan rows = cell_span(key / cl->cells_x, 1, cl->cells_y, cl->wrap_y); 
+    CellSpan columns = cell_span(key % cl->cells_x, 1, cl->cells_x, cl->wrap_x); 
+    for (uint32_t r = 0; r < rows.n; r++) {
+        for (uint32_t j = rows.begin[r]; j < rows.end[r]; j++) {
+            // cells of one row are adjacent, so the three cells are one range, 
+            // two where they wrap around a periodic seam 
+            for (uint32_t c = 0; c < columns.n; c++) {
+                uint32_t begin = cl->cell_start[j * cl->cells_x + columns.begin[c]]; 
+                uint32_t end = cl->cell_start[j * cl->cells_x + columns.end[c]]; 
+                collide_list(kernel, ps, p, cl->cell_particles + begin, end - begin, vr); 
+            }
+        }
+    }
+    ps->x[p] += ps->dpos_x[p];  
+    ps->y[p] += ps->dpos_y[p];  
+}
+
+
+// Half stencil for the k-th sorted slot: the rest of its own cell, the 
+// cells to the right and the rows above, reach_x (reach_y) cells out. The 
+// other half is covered by the particles of those cells, so every pair is 
+// visited once. Across a periodic seam the cells to the right (the rows 
+// above) continue at the first column (row). 
+static inline void particle_pairs_celllist(CollideKernel kernel, Particles* ps, Celllist* cl, uint32_t k, VirialRow* vr) {
+    uint32_t p = cl->cell_particles[k]; 
+    uint32_t key = cl->particle_cell[p]; 
+    uint32_t ci = key % cl->cells_x; 
+    uint32_t cj = key / cl->cells_x; 
+    uint32_t row = cj * cl->cells_x; 
+    uint32_t right = ci + cl->reach_x; 
+    uint32_t end = cl->cell_start[row + (right < cl->cells_x ? right : cl->cells_x - 1) + 1]; 
+    collide_list_symmetric(kernel, ps, p, cl->cell_particles + k + 1, end - k - 1, vr); 
+    if (right >= cl->cells_x && cl->wrap_x) {
+        uint32_t begin = cl->cell_start[row]; 
+        end = cl->cell_start[row + right - cl->cells_x + 1]; 
+        collide_list_symmetric(kernel, ps, p, cl->cell_particles + begin, end - begin, vr); 
+    }
+    CellSpan columns = cell_span(ci, cl->reach_x, cl->cells_x, cl->wrap_x); 
+    for (uint32_t d = 1; d <= cl->reach_y; d++) {
+        uint32_t j = cj + d; 
+        if (j >= cl->cells_y) {
+            if (!cl->wrap_y) break; 
+            j -= cl->cells_y; 
+        }
+        for (uint32_t c = 0; c < columns.n; c++) {
+            uint32_t begin = cl->cell_start[j * cl->cells_x + columns.begin[c]]; 
+            end = cl->cell_start[j * cl->cells_x + columns.end[c]]; 
+            collide_list_symmetric(kernel, ps, p, cl->cell_particles + begin, end - begin, vr); 
+        }
+    }
+}
+
+
+static int physics_tick_celllist(float dt, Chunkmap* chunkmap, float particle_radius) {
+    Particles* ps = &chunkmap->particles; 
+    Celllist* cl = &chunkmap->celllist; 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        uint32_t i = UINT32_MAX, j = UINT32_MAX;
+        particle_walls(chunkmap, ps, p, particle_radius, 0, &i, &j); 
+    }
+    celllist_build(chunkmap); 
+    if (chunkmap->pair_mode == PAIRS_JACOBI) {
+        return physics_jacobi(dt, chunkmap); 
+    }
+
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+            ps->dpos_x[p] = ps->vx[p]*dt; 
+            ps->dpos_y[p] = ps->vy[p]*dt; 
+        }
+        for (uint32_t k = 0; k < chunkmap->particles_n; k++) {
+            particle_pairs_celllist(chunkmap->collide_kernel, ps, cl, k, virial_row(chunkmap, 0)); 
+        }
+        for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+            ps->x[p] += ps->dpos_x[p];  
+            ps->y[p] += ps->dpos_y[p];  
+        }
+        return 0; 
+    }
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        particle_step_celllist(chunkmap->collide_kernel, ps, cl, p, dt, virial_row(chunkmap, 0)); 
+    }
+    return 0;
+}
+
+
+// Cells the lists reach on each side of the cell of p. The cells are about 
+// one diameter wide, the lists reach out to 2 * radius + skin, plus twice 
+// the sweep margin for swept collisions. 
+static inline void verlet_reach(Chunkmap* chunkmap, float particle_radius, uint32_t* reach_x, uint32_t* reach_y) {
+    float cutoff = 2 * particle_radius + chunkmap->verlet.skin + 2 * chunkmap->sweep_margin; 
+    *reach_x = (uint32_t) ceilf(cutoff / chunkmap->celllist.cell_size.x); 
+    *reach_y = (uint32_t) ceilf(cutoff / chunkmap->celllist.cell_size.y); 
+}
+
+
+typedef struct {
+    Chunkmap* chunkmap; 
+    uint32_t reach_x, reach_y; 
+    uint32_t tasks; 
+    bool fill; 
+} VerletBuildJob; 
+
+
+// Counts (fill = false) or writes (fill = true) the lists of a contiguous 
+// range of sorted slots. The count pass leaves the length of list k in 
+// start[k+1], the caller turns them into offsets. 
+static void verlet_job_build(void* ctx, uint32_t task, uint32_t thread) {
+    VerletBuildJob* job = ctx; 
+    Chunkmap* chunkmap = job->chunkmap; 
+    Particles* ps = &chunkmap->particles; 
+    Celllist* cl = &chunkmap->celllist; 
+    Verlet* vl = &chunkmap->verlet; 
+    bool half = chunkmap->pair_mode == PAIRS_SYMMETRIC; 
+    uint32_t begin = (uint64_t) chunkmap->particles_n * task / job->tasks; 
+    uint32_t end = (uint64_t) chunkmap->particles_n * (task + 1) / job->tasks; 
+    for (uint32_t k = begin; k < end; k++) {
+        uint32_t p = cl->cell_particles[k]; 
+        uint32_t key = cl->particle_cell[p]; 
+        uint32_t cj = key / cl->cells_x; 
+        CellSpan rows = cell_span(cj, job->reach_y, cl->cells_y, cl->wrap_y); 
+        CellSpan columns = cell_span(key % cl->cells_x, job->reach_x, cl->cells_x, cl->wrap_x); 
+        uint32_t* out = job->fill ? vl->neighbours + vl->start[k] : NULL; 
+        uint32_t n = 0; 
+        for (uint32_t r = 0; r < rows.n; r++) {
+            for (uint32_t j = rows.begin[r]; j < rows.end[r]; j++) {
+                if (half && j < cj) continue; // the slots sorted after k are in row cj or above 
+                for (uint32_t c = 0; c < columns.n; c++) {
+                    uint32_t m = cl->cell_start[j * cl->cells_x + columns.begin[c]]; 
+                    uint32_t m_end = cl->cell_start[j * cl->cells_x + columns.end[c]]; 
+                    if (half && m <= k) m = k + 1; 
+                    for (; m < m_end; m++) {
+                        uint32_t q = cl->cell_particles[m]; 
+                        float dx = min_image(ps->x[p] - ps->x[q], ps->period_x); 
+                        float dy = min_image(ps->y[p] - ps->y[q], ps->period_y); 
+                        float cutoff = ps->rad[p] + ps->rad[q] + vl->skin + 2 * chunkmap->sweep_margin; 
+                        if (q == p || dx*dx + dy*dy > cutoff*cutoff) continue; 
+                        if (out != NULL) out[n] = q; 
+                        n++; 
+                    }
+                }
+            }
+        }
+        if (!job->fill) vl->start[k + 1] = n; 
+    }
+}
+
+
+static void verlet_build_run(Threadpool* pool, VerletBuildJob* job) {
+    if (pool != NULL) {
+        threadpool_run(pool, verlet_job_build, job, job->tasks); 
+    } else {
+        verlet_job_build(job, 0, 0); 
+    }
+}
+
+
+// Rebuilds the cell list and the neighbour lists from the current positions. 
+int verlet_build(Chunkmap* chunkmap, float particle_radius) {
+    Verlet* vl = &chunkmap->verlet; 
+    Threadpool* pool = chunkmap->threadpool; 
+    celllist_build(chunkmap); 
+    VerletBuildJob job = {
+        .chunkmap = chunkmap, 
+        .tasks = pool != NULL ? 8 * pool->threads : 1, 
+    }; 
+    verlet_reach(chunkmap, particle_radius, &job.reach_x, &job.reach_y); 
+    job.fill = false; 
+    verlet_build_run(pool, &job); 
+    vl->start[0] = 0; 
+    for (uint32_t k = 0; k < chunkmap->particles_n; k++) {
+        vl->start[k + 1] += vl->start[k]; 
+    }
+    uint32_t total = vl->start[chunkmap->particles_n]; 
+    if (total > vl->capacity) {
+        // some slack, so a slowly compressing gas does not realloc every build 
+        uint32_t capacity = total + total / 4; 
+        uint32_t* neighbours = realloc(vl->neighbours, (size_t) capacity * sizeof neighbours[0]); 
+        if (neighbours == NULL) {
+            fprintf(stderr, "ERROR: realloc of verlet lists (%d entries) failed.\n", capacity);
+            return -1; 
+        }
+        vl->neighbours = neighbours; 
+        vl->capacity = capacity; 
+    }
+    job.fill = true; 
+    verlet_build_run(pool, &job); 
+    memcpy(vl->x0, chunkmap->particles.x, chunkmap->particles_n * sizeof vl->x0[0]); 
+    memcpy(vl->y0, chunkmap->particles.y, chunkmap->particles_n * sizeof vl->y0[0]); 
+    vl->stale = false; 
+    vl->half = chunkmap->pair_mode == PAIRS_SYMMETRIC; 
+    vl->builds++; 
+    return 0; 
+}
+
+
+// Bytes held by the lists, the cell list they are built from is not counted. 
+size_t verlet_memory_size(Chunkmap* chunkmap) {
+    Verlet* vl = &chunkmap->verlet; 
+    if (vl->start == NULL) return 0; 
+    return (chunkmap->particles_n + 1) * sizeof vl->start[0] + 
+        2 * chunkmap->particles_n * sizeof vl->x0[0] + 
+        (size_t) vl->capacity * sizeof vl->neighbours[0]; 
+}
+
+
+// The list of the k-th sorted slot, same update as particle_step_celllist and 
+// particle_pairs_celllist. 
+static inline void particle_step_verlet(Chunkmap* chunkmap, uint32_t k, float dt, VirialRow* vr) {
+    Particles* ps = &chunkmap->particles; 
+    Verlet* vl = &chunkmap->verlet; 
+    uint32_t p = chunkmap->celllist.cell_particles[k]; 
+    const uint32_t* list = vl->neighbours + vl->start[k]; 
+    uint32_t n = vl->start[k + 1] - vl->start[k]; 
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        collide_list_symmetric(chunkmap->collide_kernel, ps, p, list, n, vr); 
+        return; 
+    }
+    ps->dpos_x[p] = ps->vx[p]*dt; 
+    ps->dpos_y[p] = ps->vy[p]*dt; 
+    collide_list(chunkmap->collide_kernel, ps, p, list, n, vr); 
+    ps->x[p] += ps->dpos_x[p];  
+    ps->y[p] += ps->dpos_y[p];  
+}
+
+
+// squared displacement of p since the last build, a wrap around a periodic 
+// seam is no displacement 
+static inline float verlet_disp2(Verlet* vl, Particles* ps, uint32_t p) {
+    float dx = min_image(ps->x[p] - vl->x0[p], ps->period_x); 
+    float dy = min_image(ps->y[p] - vl->y0[p], ps->period_y); 
+    return dx*dx + dy*dy; 
+}
+
+
+// A particle moved at most skin/2 since the build, so a pair that touches 
+// now was within 2 * radius + skin then. Like the cell list, the lists 
+// cover the contacts at the start of the tick. 
+static inline bool verlet_needs_build(Chunkmap* chunkmap, float disp2_max) {
+    Verlet* vl = &chunkmap->verlet; 
+    bool half = chunkmap->pair_mode == PAIRS_SYMMETRIC; 
+    return vl->stale || vl->half != half || 4.0f * disp2_max > vl->skin * vl->skin; 
+}
+
+
+static int physics_tick_verlet(float dt, Chunkmap* chunkmap, float particle_radius) {
+    Particles* ps = &chunkmap->particles; 
+    Verlet* vl = &chunkmap->verlet; 
+    float disp2_max = 0.0f; 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        uint32_t i = UINT32_MAX, j = UINT32_MAX;
+        particle_walls(chunkmap, ps, p, particle_radius, 0, &i, &j); 
+        if (!vl->stale) {
+            disp2_max = new_max(disp2_max, verlet_disp2(vl, ps, p)); 
+        }
+    }
+    if (verlet_needs_build(chunkmap, disp2_max) && verlet_build(chunkmap, particle_radius) < 0) {
+        return -1; 
+    }
+    if (chunkmap->pair_mode == PAIRS_JACOBI) {
+        return physics_jacobi(dt, chunkmap); 
+    }
+
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+            ps->dpos_x[p] = ps->vx[p]*dt; 
+            ps->dpos_y[p] = ps->vy[p]*dt; 
+        }
+        for (uint32_t k = 0; k < chunkmap->particles_n; k++) {
+            particle_step_verlet(chunkmap, k, dt, virial_row(chunkmap, 0)); 
+        }
+        for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+            ps->x[p] += ps->dpos_x[p];  
+            ps->y[p] += ps->dpos_y[p];  
+        }
+        return 0; 
+    }
+    for (uint32_t k = 0; k < chunkmap->particles_n; k++) {
+        particle_step_verlet(chunkmap, k, dt, virial_row(chunkmap, 0)); 
+    }
+    return 0;
+}
+
+
+static void tick_job_walls(void* ctx, uint32_t task, uint32_t thread) {
+    TickJob* job = ctx; 
+    Chunkmap* chunkmap = job->chunkmap; 
+    uint32_t begin = task * job->slots_per_task; 
+    uint32_t end = begin + job->slots_per_task; 
+    if (end > chunkmap->particles_n) end = chunkmap->particles_n; 
+    bool verlet = chunkmap->spatial_index == SPATIAL_VERLET && !chunkmap->verlet.stale; 
+    float disp2_max = 0.0f; 
+    for (uint32_t p = begin; p < end; p++) {
+        uint32_t i = UINT32_MAX, j = UINT32_MAX;
+        particle_walls(chunkmap, &chunkmap->particles, p, job->particle_radius, thread, &i, &j); 
+        chunkmap->particles.dpos_x[p] = chunkmap->particles.vx[p]*job->dt; 
+        chunkmap->particles.dpos_y[p] = chunkmap->particles.vy[p]*job->dt; 
+        if (verlet) {
+            disp2_max = new_max(disp2_max, verlet_disp2(&chunkmap->verlet, &chunkmap->particles, p)); 
+        }
+    }
+    if (verlet) {
+        // non negative floats order like their bits, so a CAS max on the 
+        // bits is a max on the floats 
+        uint32_t bits; 
+        memcpy(&bits, &disp2_max, sizeof bits); 
+        uint32_t seen = atomic_load(&job->disp2_max); 
+        while (bits > seen && !atomic_compare_exchange_weak(&job->disp2_max, &seen, bits)); 
+    }
+}
+
+
+// A band of rows_per_band cell rows. p touches the rows next to its own, so 
+// two bands of the same colour (every other band) are far enough apart as 
+// long as a band has at least 2 rows. The half stencil only reaches up, 
+// which is covered by the same argument. Verlet lists and the wider swept 
+// stencil reach reach_y rows, which needs 2 * reach_y rows per band. The last band runs to the top row, 
+// see tick_run_bands for a periodic y axis. 
+static void tick_job_band(void* ctx, uint32_t task, uint32_t thread) {
+    TickJob* job = ctx; 
+    Celllist* cl = &job->chunkmap->celllist; 
+    uint32_t band = job->colour == 2 ? job->bands - 1 : 2 * task + job->colour; 
+    if (band >= job->bands || (job->colours == 3 && job->colour < 2 && band == job->bands - 1)) return; 
+    uint32_t row_begin = band * job->rows_per_band; 
+    uint32_t row_end = band == job->bands - 1 ? cl->cells_y : row_begin + job->rows_per_band; 
+    // the rows of a band are one range in the sorted slots 
+    uint32_t begin = cl->cell_start[row_begin * cl->cells_x]; 
+    uint32_t end = cl->cell_start[row_end * cl->cells_x]; 
+    VirialRow* vr = virial_row(job->chunkmap, thread); 
+    for (uint32_t k = begin; k < end; k++) {
+        if (job->chunkmap->spatial_index == SPATIAL_VERLET) {
+            particle_step_verlet(job->chunkmap, k, job->dt, vr); 
+        } else if (job->chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+            particle_pairs_celllist(job->chunkmap->collide_kernel, &job->chunkmap->particles, cl, k, vr); 
+        } else {
+            particle_step_celllist(job->chunkmap->collide_kernel, &job->chunkmap->particles, cl, cl->cell_particles[k], job->dt, vr); 
+        }
+    }
+}
+
+
+// tick_job_band over all bands, colour by colour. Around a periodic y axis 
+// the last band touches band 0: a short last band would let the bands on 
+// either side of it touch, so it is merged into the one below, and an odd 
+// number of bands gives the last one a colour of its own. 
+static void tick_run_bands(Threadpool* pool, TickJob* job) {
+    Celllist* cl = &job->chunkmap->celllist; 
+    if (cl->wrap_y) {
+        job->bands = new_max(cl->cells_y / job->rows_per_band, 1); 
+        job->colours = job->bands > 1 && job->bands % 2 == 1 ? 3 : 2; 
+    } else {
+        job->bands = (cl->cells_y + job->rows_per_band - 1) / job->rows_per_band; 
+        job->colours = 2; 
+    }
+    for (job->colour = 0; job->colour < job->colours; job->colour++) {
+        threadpool_run(pool, tick_job_band, job, job->colour == 2 ? 1 : (job->bands + 1) / 2); 
+    }
+}
+
+
+static int physics_tick_celllist_threaded(float dt, Chunkmap* chunkmap, float particle_radius) {
+    Threadpool* pool = chunkmap->threadpool; 
+    Celllist* cl = &chunkmap->celllist; 
+    TickJob job = {
+        .chunkmap = chunkmap, 
+        .dt = dt, 
+        .particle_radius = particle_radius, 
+        .slots_per_task = 4096, 
+        .rows_per_band = new_max(cl->cells_y / (8 * pool->threads), 2 * cl->reach_y), 
+    }; 
+    threadpool_run(pool, tick_job_walls, &job, (chunkmap->particles_n + job.slots_per_task - 1) / job.slots_per_task); 
+    celllist_build(chunkmap); 
+    if (chunkmap->pair_mode == PAIRS_JACOBI) {
+        return physics_jacobi(dt, chunkmap); 
+    }
+    tick_run_bands(pool, &job); 
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        threadpool_run(pool, tick_job_integrate, &job, (chunkmap->particles_n + job.slots_per_task - 1) / job.slots_per_task); 
+    }
+    return 0;
+}
+
+
+static int physics_tick_verlet_threaded(float dt, Chunkmap* chunkmap, float particle_radius) {
+    Threadpool* pool = chunkmap->threadpool; 
+    Celllist* cl = &chunkmap->celllist; 
+    uint32_t reach_x, reach_y; 
+    verlet_reach(chunkmap, particle_radius, &reach_x, &reach_y); 
+    TickJob job = {
+        .chunkmap = chunkmap, 
+        .dt = dt, 
+        .particle_radius = particle_radius, 
+        .slots_per_task = 4096, 
+        .rows_per_band = new_max(cl->cells_y / (8 * pool->threads), 2 * reach_y), 
+    }; 
+    atomic_init(&job.disp2_max, 0); 
+    threadpool_run(pool, tick_job_walls, &job, (chunkmap->particles_n + job.slots_per_task - 1) / job.slots_per_task); 
+    uint32_t bits = atomic_load(&job.disp2_max); 
+    float disp2_max; 
+    memcpy(&disp2_max, &bits, sizeof disp2_max); 
+    if (verlet_needs_build(chunkmap, disp2_max) && verlet_build(chunkmap, particle_radius) < 0) {
+        return -1; 
+    }
+    if (chunkmap->pair_mode == PAIRS_JACOBI) {
+        return physics_jacobi(dt, chunkmap); 
+    }
+    tick_run_bands(pool, &job); 
+    if (chunkmap->pair_mode == PAIRS_SYMMETRIC) {
+        threadpool_run(pool, tick_job_integrate, &job, (chunkmap->particles_n + job.slots_per_task - 1) / job.slots_per_task); 
+    }
+    return 0;
+}
+
+
+void chunkmap_free_verlet(Chunkmap* chunkmap) {
+    Verlet* vl = &chunkmap->verlet; 
+    free(vl->start); 
+    free(vl->neighbours); 
+    free(vl->x0); 
+    free(vl->y0); 
+    vl->start = NULL; 
+    vl->neighbours = NULL; 
+    vl->x0 = NULL; 
+    vl->y0 = NULL; 
+    vl->capacity = 0; 
+}
+
+
+int chunkmap_set_spatial_index(Chunkmap* chunkmap, SpatialIndex spatial_index) {
+    if (spatial_index >= SPATIAL_COUNTER) {
+        fprintf(stderr, "ERROR: invalid spatial index %d\n", spatial_index);
+        return -1; 
+    }
+    if (spatial_index == SPATIAL_VERLET && !(chunkmap->verlet.skin >= 0.0f)) {
+        fprintf(stderr, "ERROR: verlet skin must not be negative, got %f\n", chunkmap->verlet.skin);
+        return -1; 
+    }
+    if (spatial_index == SPATIAL_VERLET && chunkmap->verlet.start == NULL) {
+        Verlet* vl = &chunkmap->verlet; 
+        vl->start = malloc((chunkmap->particles_n + 1) * sizeof vl->start[0]); 
+        vl->x0 = malloc(chunkmap->particles_n * sizeof vl->x0[0]); 
+        vl->y0 = malloc(chunkmap->particles_n * sizeof vl->y0[0]); 
+        if (vl->start == NULL || vl->x0 == NULL || vl->y0 == NULL) {
+            fprintf(stderr, "ERROR: malloc of verlet lists failed.\n");
+            chunkmap_free_verlet(chunkmap); 
+            return -1; 
+        }
+    }
+    // The chunk refs are not touched by the cell list path. They stay valid, 
+    // so switching back just moves every particle to its current chunks. 
+    // The verlet lists are rebuilt, the particles moved in the meantime. 
+    chunkmap->verlet.stale = true; 
+    chunkmap->spatial_index = spatial_index; 
+    return 0; 
+}
+
+
+void chunkmap_free_threadpool(Chunkmap* chunkmap) {
+    if (chunkmap->migrations != NULL) {
+        for (uint32_t t = 0; t < chunkmap->threadpool->threads; t++) {
+            free(chunkmap->migrations[t].items); 
+        }
+    }
+    free(chunkmap->migrations); 
+    chunkmap->migrations = NULL; 
+    chunkmap->threadpool = NULL; 
+}
+
+
+int chunkmap_set_threadpool(Chunkmap* chunkmap, Threadpool* pool) {
+    chunkmap_free_threadpool(chunkmap); 
+    if (chunkmap->pressure.segments > 0 && pressure_set_threads(&chunkmap->pressure, pool != NULL ? pool->threads : 1) < 0) {
+        return -1; 
+    }
+    if (chunkmap->virial.enabled && virial_set_threads(chunkmap, pool != NULL ? pool->threads : 1) < 0) {
+        return -1; 
+    }
+    if (chunkmap->dt_control.enabled && dt_control_set_threads(&chunkmap->dt_control, pool != NULL ? pool->threads : 1) < 0) {
+        return -1; 
+    }
+    if (pool == NULL || pool->threads <= 1) {
+        return 0; 
+    }
+    chunkmap->migrations = calloc(pool->threads, sizeof chunkmap->migrations[0]); 
+    if (chunkmap->migrations == NULL) {
+        fprintf(stderr, "ERROR: malloc of %d migration buffers failed.\n", pool->threads);
+        return -1; 
+    }
+    chunkmap->threadpool = pool; 
+    return 0; 
+}
+
+
+
+
+// Spreads the lower 16 bits of v to the even bits. 
+static inline uint32_t morton_part1by1(uint32_t v) {
+    v &= 0x0000ffff; 
+    v = (v | (v << 8)) & 0x00ff00ff; 
+    v = (v | (v << 4)) & 0x0f0f0f0f; 
+    v = (v | (v << 2)) & 0x33333333; 
+    v = (v | (v << 1)) & 0x55555555; 
+    return v; 
+}
+
+
+static inline uint32_t particle_morton_key(Chunkmap* chunkmap, uint32_t p) {
+    float fx = chunkmap->particles.x[p] / chunkmap->dimensions.x; 
+    float fy = chunkmap->particles.y[p] / chunkmap->dimensions.y; 
+    fx = fx < 0.0f ? 0.0f : (fx > 1.0f ? 1.0f : fx); 
+    fy = fy < 0.0f ? 0.0f : (fy > 1.0f ? 1.0f : fy); 
+    return morton_part1by1((uint32_t)(fx * 65535.0f)) | (morton_part1by1((uint32_t)(fy * 65535.0f)) << 1); 
+}
+
+
+// Fraction of neighbouring slots that are more than 4 cell list cells apart 
+// in space. Close to 0 for the start lattice and right after a reorder, it 
+// goes to 1 as the particles diffuse away from their slot neighbours. 
+float particles_disorder(Chunkmap* chunkmap) {
+    if (chunkmap->particles_n < 2) return 0.0f; 
+    Particles* ps = &chunkmap->particles; 
+    float dx_max = 4.0f * chunkmap->celllist.cell_size.x; 
+    float dy_max = 4.0f * chunkmap->celllist.cell_size.y; 
+    uint32_t far = 0; 
+    for (uint32_t p = 1; p < chunkmap->particles_n; p++) {
+        far += fabsf(ps->x[p] - ps->x[p-1]) > dx_max || fabsf(ps->y[p] - ps->y[p-1]) > dy_max; 
+    }
+    return (float) far / (chunkmap->particles_n - 1); 
+}
+
+
+// Sorts the particle slots along a Morton curve, so particles that are close 
+// in space are close in memory again. Every column moves, the chunk lists get 
+// the new slots and id_slot follows. The chunk refs stay valid as they are, 
+// the position of a particle inside a chunk list does not change. 
+int particles_reorder_morton(Chunkmap* chunkmap) {
+    uint32_t n = chunkmap->particles_n; 
+    Particles* ps = &chunkmap->particles; 
+    size_t scratch_size = new_max(n * sizeof ps->chunk_refs[0], 4 * n * sizeof(uint32_t)); 
+    void* scratch = malloc(scratch_size); 
+    uint32_t* order = malloc(n * sizeof order[0]); 
+    uint32_t* keys = malloc(n * sizeof keys[0]); 
+    if (scratch == NULL || order == NULL || keys == NULL) {
+        fprintf(stderr, "ERROR: malloc of reorder scratch (size=%zu) failed.\n", scratch_size);
+        free(scratch); 
+        free(order); 
+        free(keys); 
+        return -1; 
+    }
+
+    // LSD radix sort of (key, slot), 4 passes of 8 bits, same counting 
+    // sort as celllist_build 
+    uint32_t* keys_tmp = scratch; 
+    uint32_t* order_tmp = keys_tmp + n; 
+    for (uint32_t p = 0; p < n; p++) {
+        keys[p] = particle_morton_key(chunkmap, p); 
+        order[p] = p; 
+    }
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t count[257] = { 0 }; 
+        for (uint32_t k = 0; k < n; k++) {
+            count[((keys[k] >> shift) & 0xff) + 1]++; 
+        }
+        for (uint32_t b = 0; b < 256; b++) {
+            count[b + 1] += count[b]; 
+        }
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t dst = count[(keys[k] >> shift) & 0xff]++; 
+            keys_tmp[dst] = keys[k]; 
+            order_tmp[dst] = order[k]; 
+        }
+        memcpy(keys, keys_tmp, n * sizeof keys[0]); 
+        memcpy(order, order_tmp, n * sizeof order[0]); 
+    }
+
+    // order[new slot] = old slot 
+#define permute_column(_column) \
+    for (uint32_t k = 0; k < n; k++) { \
+        memcpy((char*)scratch + k * sizeof ps->_column[0], &ps->_column[order[k]], sizeof ps->_column[0]); \
+    } \
+    memcpy(ps->_column, scratch, n * sizeof ps->_column[0])
+
+    permute_column(x); 
+    permute_column(y); 
+    permute_column(rad); 
+    permute_column(vx); 
+    permute_column(vy); 
+    permute_column(dpos_x); 
+    permute_column(dpos_y); 
+    permute_column(partner); 
+    permute_column(mass); 
+    permute_column(overlap); 
+    permute_column(chunk_refs); 
+    permute_column(chunk_state); 
+    permute_column(id); 
+#undef permute_column
+
+    // keys is free now, reuse it for old slot -> new slot 
+    uint32_t* new_slot = keys; 
+    for (uint32_t k = 0; k < n; k++) {
+        new_slot[order[k]] = k; 
+    }
+    for (uint32_t i = 0; i < chunkmap->chunks_x; i++) {
+        for (uint32_t j = 0; j < chunkmap->chunks_y; j++) {
+            Chunk* chunk = chunkmap->chunks[i][j]; 
+            for (uint32_t k = 0; k < chunk->particles_filled; k++) {
+                chunk->particles[k] = new_slot[chunk->particles[k]]; 
+            }
+        }
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        chunkmap->id_slot[ps->id[k]] = k; 
+    }
+    chunkmap->verlet.stale = true; // the lists hold old slots 
+    chunkmap->events.stale = true; 
+    chunkmap->reorders++; 
+
+    free(scratch); 
+    free(order); 
+    free(keys); 
+    return 0; 
+}
+
+
+#define REORDER_CHECK_TICKS 64 // particles_disorder is a full pass, don't run it every tick 
+#define REGRID_CHECK_TICKS 256 
+
+#define DT_GROW 1.05f          // per tick while the overlaps stay below half the target 
+#define DT_SHRINK_MAX 0.5f     // at most halved per tick 
+
+static float particles_v2_max(Particles* ps, uint32_t n) {
+    float v2_max = 0.0f; 
+    for (uint32_t p = 0; p < n; p++) {
+        v2_max = new_max(v2_max, ps->vx[p]*ps->vx[p] + ps->vy[p]*ps->vy[p]); 
+    }
+    return v2_max; 
+}
+
+
+int dt_control_set_threads(DtControl* dc, uint32_t threads) {
+    if (threads == 0) threads = 1; 
+    free(dc->rows); 
+    dc->threads = threads; 
+    dc->rows = aligned_alloc(PS_ALIGN, threads * sizeof dc->rows[0]); 
+    if (dc->rows == NULL) {
+        fprintf(stderr, "ERROR: malloc of %d dt control rows failed.\n", threads);
+        dc->enabled = false; 
+        return -1; 
+    }
+    memset(dc->rows, 0, threads * sizeof dc->rows[0]); 
+    return 0; 
+}
+
+
+void dt_control_free(DtControl* dc) {
+    free(dc->rows); 
+    if (dc->log != NULL) {
+        fclose(dc->log); 
+    }
+    *dc = (DtControl) { 0 }; 
+}
+
+
+// dt_min = 0 turns the controller off. log_path NULL or "" = no log. 
+int dt_control_init(Chunkmap* chunkmap, float dt_min, float overlap_target, const char* log_path) {
+    DtControl* dc = &chunkmap->dt_control; 
+    dt_control_free(dc); 
+    if (dt_min <= 0.0f) {
+        return 0; 
+    }
+    if (overlap_target <= 0.0f) {
+        fprintf(stderr, "ERROR: dt control needs an overlap target > 0, got %g.\n", overlap_target);
+        return -1; 
+    }
+    dc->dt_min = dt_min; 
+    dc->overlap_target = overlap_target; 
+    if (log_path != NULL && log_path[0] != '\0') {
+        dc->log = fopen(log_path, "w"); 
+        if (dc->log == NULL) {
+            fprintf(stderr, "ERROR: could not open dt log %s.\n", log_path);
+            return -1; 
+        }
+        fprintf(dc->log, "tick,time,dt,v_max,overlap\n"); 
+    }
+    memset(chunkmap->particles.overlap, 0, chunkmap->particles_n * sizeof chunkmap->particles.overlap[0]); 
+    dc->enabled = true; 
+    return dt_control_set_threads(dc, chunkmap->threadpool != NULL ? chunkmap->threadpool->threads : 1); 
+}
+
+
+// After a tick of length dt: reduces the rows particle_walls filled and 
+// picks the next dt. The speeds are the ones at the start of the tick, the 
+// overlaps the ones collide left in the tick before. 
+static void dt_control_tick(Chunkmap* chunkmap, float dt, float particle_radius) {
+    DtControl* dc = &chunkmap->dt_control; 
+    float v2_max = 0.0f; 
+    float overlap_max = 0.0f; 
+    for (uint32_t t = 0; t < dc->threads; t++) {
+        v2_max = new_max(v2_max, dc->rows[t].v2_max); 
+        overlap_max = new_max(overlap_max, dc->rows[t].overlap_max); 
+        dc->rows[t].v2_max = 0.0f; 
+        dc->rows[t].overlap_max = 0.0f; 
+    }
+    dc->v_max = sqrtf(v2_max); 
+    dc->overlap_max = overlap_max / particle_radius; 
+    float next = dt; 
+    if (dc->overlap_max > dc->overlap_target) {
+        next *= new_max(DT_SHRINK_MAX, dc->overlap_target / dc->overlap_max); 
+        dc->shrinks++; 
+    } else if (dc->overlap_max < 0.5f * dc->overlap_target) {
+        next *= DT_GROW; 
+    }
+    // a head-on pair closer than one radius per tick can pass the midpoint 
+    // and get pushed through each other 
+    if (dc->v_max > 0.0f) {
+        next = new_min(next, particle_radius / dc->v_max); 
+    }
+    dc->dt = new_max(next, dc->dt_min); 
+    if (dc->log != NULL) {
+        fprintf(dc->log, "%llu,%.6f,%g,%g,%g\n", (unsigned long long) chunkmap->ticks, chunkmap->time, dt, dc->v_max, dc->overlap_max); 
+    }
+}
+
+
+// Length of the next tick: dt, or the one the dt controller picked if that 
+// is shorter, capped so that no particle gets further than cfl radii. Swept 
+// collisions and walls read it from the particles. 
+static float physics_dt(Chunkmap* chunkmap, float dt, float particle_radius) {
+    Particles* ps = &chunkmap->particles; 
+    DtControl* dc = &chunkmap->dt_control; 
+    if (dc->enabled) {
+        if (dc->dt == 0.0f) {
+            // first tick, nothing reduced yet: start at the speed cap 
+            float v2_max = particles_v2_max(ps, chunkmap->particles_n); 
+            dc->dt = v2_max > 0.0f ? new_min(dt, particle_radius / sqrtf(v2_max)) : dt; 
+        }
+        dt = new_min(new_max(dc->dt, dc->dt_min), dt); 
+    }
+    if (chunkmap->cfl > 0.0f) {
+        float v2_max = particles_v2_max(ps, chunkmap->particles_n); 
+        if (v2_max > 0.0f) {
+            dt = new_min(dt, chunkmap->cfl * particle_radius / sqrtf(v2_max)); 
+        }
+    }
+    ps->sweep_dt = chunkmap->collide_mode == COLLIDE_MODE_SWEPT ? dt : 0.0f; 
+    return dt; 
+}
+
+
+// One tick of ENGINE_TICK through the spatial index. 
+static int physics_tick_index(float dt, Chunkmap* chunkmap, float particle_radius) {
+    int result = 0; 
+    switch (chunkmap->spatial_index) {
+    case SPATIAL_CHUNKREFS: {
+        if (chunkmap->threadpool != NULL) {
+            result = physics_tick_chunkrefs_threaded(dt, chunkmap, particle_radius); 
+        } else {
+            result = physics_tick_chunkrefs(dt, chunkmap, particle_radius); 
+        }
+    } break; 
+    case SPATIAL_CELLLIST: {
+        if (chunkmap->threadpool != NULL) {
+            result = physics_tick_celllist_threaded(dt, chunkmap, particle_radius); 
+        } else {
+            result = physics_tick_celllist(dt, chunkmap, particle_radius); 
+        }
+    } break; 
+    case SPATIAL_VERLET: {
+        if (chunkmap->threadpool != NULL) {
+            result = physics_tick_verlet_threaded(dt, chunkmap, particle_radius); 
+        } else {
+            result = physics_tick_verlet(dt, chunkmap, particle_radius); 
+        }
+    } break; 
+    default: {
+        fprintf(stderr, "invalid spatial index\n");
+        return -1; 
+    } break; 
+    }
+    return result; 
+}
+
+
+// dt is the longest tick, the cfl cap can make it shorter, see dt_tick. 
+// The event driven engine always covers dt, it has no step to cap. 
+int physics_tick(float dt, Chunkmap* chunkmap, float particle_radius, Container* container) {
+    int result = 0; 
+    float dt_max = dt; 
+    if (chunkmap->engine == ENGINE_EVENTS) {
+        result = events_advance(chunkmap, dt, particle_radius); 
+    } else {
+        dt = physics_dt(chunkmap, dt_max, particle_radius); 
+        result = physics_tick_index(dt, chunkmap, particle_radius); 
+    }
+    if (result < 0) {
+        return result; 
+    }
+
+    chunkmap->ticks++; 
+    chunkmap->dt_tick = dt; 
+    chunkmap->time += dt; 
+    if (chunkmap->dt_control.enabled && chunkmap->engine == ENGINE_TICK) {
+        dt_control_tick(chunkmap, dt, particle_radius); 
+    }
+    if (chunkmap->pressure.segments > 0) {
+        pressure_tick(chunkmap, dt); 
+    }
+    if (chunkmap->virial.enabled) {
+        virial_tick(chunkmap, dt); 
+    }
+    // the density drifted away from the one the grid was tuned for 
+    if (chunkmap->regrid_tolerance > 0.0f && chunkmap->engine == ENGINE_TICK && chunkmap->spatial_index == SPATIAL_CHUNKREFS && chunkmap->ticks % REGRID_CHECK_TICKS == 0) {
+        float density = chunkmap_density(chunkmap); 
+        float ratio = density / chunkmap->regrid_density; 
+        if (chunkmap->regrid_density == 0.0f) {
+            chunkmap->regrid_density = density; // grid of setup_simulation_memory, never tuned 
+        } else if (ratio > chunkmap->regrid_tolerance || ratio * chunkmap->regrid_tolerance < 1.0f) {
+            printf("regrid: density changed by %.2fx\n", ratio); 
+            uint32_t ticks = chunkmap->autotune_ticks > 0 ? chunkmap->autotune_ticks : AUTOTUNE_TICKS; 
+            if (chunkmap_autotune(chunkmap, ticks, dt_max, particle_radius, container) < 0) {
+                return -1; 
+            }
+        }
+    }
+    bool reorder = chunkmap->reorder_interval > 0 && chunkmap->ticks % chunkmap->reorder_interval == 0; 
+    if (!reorder && chunkmap->reorder_threshold > 0.0f && chunkmap->ticks % REORDER_CHECK_TICKS == 0) {
+        reorder = particles_disorder(chunkmap) > chunkmap->reorder_threshold; 
+    }
+    if (reorder) {
+        return particles_reorder_morton(chunkmap); 
+    }
+    return 0; 
+}
+
+
+// The GPU buffer is indexed by particle id, so instances keep their index 
+// when the slots are reordered. 
+void particles_write_gpu(Chunkmap* chunkmap, Container* container, GPUParticle* gpu_particles) {
+    const float* x = chunkmap->particles.x; 
+    const float* y = chunkmap->particles.y; 
+    const uint32_t* id = chunkmap->particles.id; 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        gpu_particles[id[p]].x = -1.0f + x[p] * container->scalar; 
+        gpu_particles[id[p]].y = -1.0f + y[p] * container->zoom;
+    }
+}
+
+
+// 65535 steps across the container, a step is width/65535 container units: 
+// 0.02 pixels of a 1400 wide window, a pixel once the camera zooms in ~45x. 
+static void particles_write_gpu_q16(Chunkmap* chunkmap, Container* container, GPUParticleQ16* gpu_particles) {
+    const float* x = chunkmap->particles.x; 
+    const float* y = chunkmap->particles.y; 
+    const uint32_t* id = chunkmap->particles.id; 
+    const float qx = 65535.0f / container->width; 
+    const float qy = 65535.0f / container->height; 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        int32_t ix = (int32_t) (x[p] * qx + 0.5f); 
+        int32_t iy = (int32_t) (y[p] * qy + 0.5f); 
+        gpu_particles[id[p]] = (GPUParticleQ16) { 
+            .x = (uint16_t) new_min(new_max(ix, 0), 65535), 
+            .y = (uint16_t) new_min(new_max(iy, 0), 65535) 
+        }; 
+    }
+}
+
+
+// Container coords to GPUParticle or GPUParticleQ16, packed from 0. 
+typedef struct {
+    void* gpu_particles; 
+    bool quantize; 
+    float scale_x, scale_y; 
+    float offset_x, offset_y; 
+    uint32_t n; 
+} GPUWriter; 
+
+
+static GPUWriter gpu_writer(Container* container, bool quantize, void* gpu_particles) {
+    if (quantize) {
+        return (GPUWriter) { gpu_particles, true, 65535.0f / container->width, 65535.0f / container->height, 0.5f, 0.5f, 0 }; 
+    }
+    return (GPUWriter) { gpu_particles, false, container->scalar, container->zoom, -1.0f, -1.0f, 0 }; 
+}
+
+
+static inline void gpu_writer_put(GPUWriter* w, float x, float y) {
+    float gx = x * w->scale_x + w->offset_x; 
+    float gy = y * w->scale_y + w->offset_y; 
+    if (w->quantize) {
+        int32_t ix = (int32_t) gx, iy = (int32_t) gy; 
+        ((GPUParticleQ16*) w->gpu_particles)[w->n++] = (GPUParticleQ16) { 
+            .x = (uint16_t) new_min(new_max(ix, 0), 65535), 
+            .y = (uint16_t) new_min(new_max(iy, 0), 65535) 
+        }; 
+    } else {
+        ((GPUParticle*) w->gpu_particles)[w->n++] = (GPUParticle) { gx, gy }; 
+    }
+}
+
+
+static inline bool particle_in_view(const Particles* ps, uint32_t p, Box view) {
+    float r = ps->rad[p]; 
+    return ps->x[p] + r >= view.l && ps->x[p] - r <= view.r && ps->y[p] + r >= view.b && ps->y[p] - r <= view.t; 
+}
+
+
+// Columns (or rows) of the chunks whose home particles can reach into 
+// [lo, hi]: a home chunk holds the bottom left of the particle's box, so 
+// the range starts one reach further down, and the memberships are from 
+// before the last move, one more chunk on both sides. Periodic axes wrap 
+// it around, column k of the result is lo_out + k taken mod n. A view off 
+// the container gives an empty range (hi_out < lo_out). 
+static inline void view_chunk_range(float lo, float hi, float size, float reach, uint32_t n, bool periodic, int32_t* lo_out, int32_t* hi_out) {
+    float f0 = floorf((lo - reach) / size) - 1.0f; 
+    float f1 = floorf(hi / size) + 1.0f; 
+    float low = periodic ? -(float) n : 0.0f; // clamped as floats, a far pan must not overflow the casts 
+    int32_t i0 = new_min(new_max(f0, low), (float) n); 
+    int32_t i1 = new_min(new_max(f1, low - 1.0f), (float) n - 1.0f); 
+    if (i1 - i0 >= (int32_t) n) i0 = i1 - n + 1; // each column once 
+    *lo_out = i0; 
+    *hi_out = i1; 
+}
+
+
+#define VIEW_WALK_FRACTION 16 
+
+
+// A zoomed in view only touches the chunks it intersects, so the cost 
+// follows the visible particles instead of particles_n. Every particle is 
+// written once, from its home chunk. The chunk lists are only kept up to 
+// date by SPATIAL_CHUNKREFS and ENGINE_TICK, everything else tests every 
+// particle against the view. 
+uint32_t particles_write_gpu_view(Chunkmap* chunkmap, Container* container, Box view, float particle_radius, bool quantize, void* gpu_particles) {
+    if (view.l <= 0.0f && view.b <= 0.0f && view.r >= container->width && view.t >= container->height) {
+        if (quantize) {
+            particles_write_gpu_q16(chunkmap, container, gpu_particles); 
+        } else {
+            particles_write_gpu(chunkmap, container, gpu_particles); 
+        }
+        return chunkmap->particles_n; 
+    }
+    Particles* ps = &chunkmap->particles; 
+    GPUWriter w = gpu_writer(container, quantize, gpu_particles); 
+    float reach = 2.0f * particle_radius + chunkmap->sweep_margin; 
+    int32_t nx = chunkmap->chunks_x, ny = chunkmap->chunks_y; 
+    int32_t i0, i1, j0, j1; 
+    view_chunk_range(view.l, view.r, chunkmap->chunks_size.x, reach, nx, chunkmap->boundary_x == BOUNDARY_PERIODIC, &i0, &i1); 
+    view_chunk_range(view.b, view.t, chunkmap->chunks_size.y, reach, ny, chunkmap->boundary_y == BOUNDARY_PERIODIC, &j0, &j1); 
+    int64_t walked = (int64_t) new_max(i1 - i0 + 1, 0) * new_max(j1 - j0 + 1, 0); 
+    // the chunk lists hit the slots in random order, a linear scan is 
+    // faster once the view spans more than about a 16th of the chunks 
+    if (chunkmap->spatial_index != SPATIAL_CHUNKREFS || chunkmap->engine != ENGINE_TICK || walked * VIEW_WALK_FRACTION > (int64_t) nx * ny) {
+        for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+            if (particle_in_view(ps, p, view)) gpu_writer_put(&w, ps->x[p], ps->y[p]); 
+        }
+        return w.n; 
+    }
+    for (int32_t i = i0; i <= i1; i++) {
+        for (int32_t j = j0; j <= j1; j++) {
+            Chunk* chunk = chunkmap->chunks[((i % nx) + nx) % nx][((j % ny) + ny) % ny]; 
+            for (uint32_t k = 0; k < chunk->particles_filled; k++) {
+                uint32_t p = chunk->particles[k]; 
+                if (particle_home_chunk(ps, p) != chunk || !particle_in_view(ps, p, view)) continue; 
+                gpu_writer_put(&w, ps->x[p], ps->y[p]); 
+            }
+        }
+    }
+    return w.n; 
+}
+
+
+// Alpha follows the density, 1 - exp(-count / mean count), so the mean 
+// reads 0.63 and empty cells show the background. The color is the mean 
+// v^2 of the cell against the one of every binned particle, blue for cold 
+// to red at twice the mean. 
+uint32_t particles_write_density(Chunkmap* chunkmap, Box view, uint32_t grid_w, uint32_t grid_h, float* bins, uint8_t (*texels)[4]) {
+    const Particles* ps = &chunkmap->particles; 
+    uint32_t cells = grid_w * grid_h; 
+    float* count = bins; 
+    float* v2 = bins + cells; 
+    memset(bins, 0, 2 * (size_t) cells * sizeof bins[0]); 
+    float sx = grid_w / (view.r - view.l); 
+    float sy = grid_h / (view.t - view.b); 
+    uint32_t binned = 0; 
+    double v2_sum = 0.0; 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        float fx = (ps->x[p] - view.l) * sx; 
+        float fy = (ps->y[p] - view.b) * sy; 
+        if (!(fx >= 0.0f && fx < grid_w && fy >= 0.0f && fy < grid_h)) continue; 
+        uint32_t c = (uint32_t) fy * grid_w + (uint32_t) fx; 
+        float e = ps->vx[p] * ps->vx[p] + ps->vy[p] * ps->vy[p]; 
+        count[c] += 1.0f; 
+        v2[c] += e; 
+        v2_sum += e; 
+        binned++; 
+    }
+    float inv_mean = binned > 0 ? (float) cells / binned : 0.0f; 
+    float inv_hot = v2_sum > 0.0 ? (float) (binned / (2.0 * v2_sum)) : 0.0f; 
+    for (uint32_t c = 0; c < cells; c++) {
+        if (count[c] == 0.0f) {
+            memset(texels[c], 0, sizeof texels[c]); 
+            continue; 
+        }
+        float alpha = 1.0f - expf(-count[c] * inv_mean); 
+        float t = new_min(v2[c] / count[c] * inv_hot, 1.0f); 
+        texels[c][0] = (uint8_t) (255.0f * t); 
+        texels[c][1] = 64; 
+        texels[c][2] = (uint8_t) (255.0f * (1.0f - t)); 
+        texels[c][3] = (uint8_t) (255.0f * alpha); 
+    }
+    return binned; 
+}
+
+
+// Initial lattice of setup_particles, one particle per 2(r+pad) square. The 
+// gpu coords bound it as before, the container too now that zoom is a setting. 
+static void particles_lattice(Container* container, float particle_radius, uint32_t* per_row, uint32_t* per_col) {
+    float pad = 1.0f * particle_radius; 
+    uint32_t particles_per_row = 1.0f/((particle_radius + pad)*container->scalar);
+    uint32_t particles_per_col = 1.0f/((particle_radius + pad)*container->zoom);
+    uint32_t fit_row = container->width / (2.0f*(particle_radius + pad)); 
+    uint32_t fit_col = container->height / (2.0f*(particle_radius + pad)); 
+    *per_row = particles_per_row < fit_row ? particles_per_row : fit_row; 
+    *per_col = particles_per_col < fit_col ? particles_per_col : fit_col; 
+}
+
+
+uint32_t particles_n_max(Container* container, float particle_radius) {
+    uint32_t per_row, per_col; 
+    particles_lattice(container, particle_radius, &per_row, &per_col); 
+    return per_row*per_col;
+}
+
+
+// One step of the setup binning: p overlaps chunk, the chunks are visited 
+// column by column (i outer, j inner) and every chunk sees its particles in 
+// slot order. 
+static int setup_particle_chunk(Particles* ps, uint32_t p, Chunk* chunk) {
+    switch (ps->chunk_state[p]) {
+        case CS_INVALID: {
+            particle_set_chunkref(ps, p, 0, chunk);
+            ps->chunk_state[p] = CS_ONE; 
+        } break; 
+        case CS_ONE: {
+            if (ps->chunk_refs[p][0].chunk->right == chunk) { // the way we iterate, we only have to check if its a chunk to the right  
+                particle_set_chunkref(ps, p, 1, chunk); 
+                ps->chunk_state[p] = CS_LR; 
+            } else if (ps->chunk_refs[p][0].chunk->top == chunk) {
+                Chunk* chunk_bottom = ps->chunk_refs[p][0].chunk;
+                particle_remove_chunkref(ps, p, 0); 
+                particle_set_chunkref(ps, p, 2, chunk); 
+                particle_set_chunkref(ps, p, 3, chunk_bottom); 
+                ps->chunk_state[p] = CS_TB; 
+            }
+        } break; 
+        case CS_TB: { 
+            Chunk* chunk_top_right = ps->chunk_refs[p][2].chunk->right; 
+            Chunk* chunk_bottom_right = ps->chunk_refs[p][3].chunk->right; 
+            particle_set_chunkref(ps, p, 0, chunk_bottom_right);
+            particle_set_chunkref(ps, p, 1, chunk_top_right);
+            ps->chunk_state[p] = CS_LRTB; 
+        } break; 
+        case CS_LR: { 
+            Chunk* chunk_top_left = ps->chunk_refs[p][0].chunk->top; 
+            Chunk* chunk_top_right = ps->chunk_refs[p][1].chunk->top; 
+            Chunk* chunk_bottom_right = ps->chunk_refs[p][1].chunk; 
+            Chunk* chunk_bottom_left = ps->chunk_refs[p][0].chunk; 
+            particle_remove_chunkref(ps, p, 0); 
+            particle_remove_chunkref(ps, p, 1); 
+            particle_set_chunkref(ps, p, 0, chunk_bottom_right);
+            particle_set_chunkref(ps, p, 1, chunk_top_right);
+            particle_set_chunkref(ps, p, 2, chunk_top_left);
+            particle_set_chunkref(ps, p, 3, chunk_bottom_left);
+            ps->chunk_state[p] = CS_LRTB; 
+        } break; 
+        case CS_LRTB: { // nothing to do here 
+        } break; 
+        default: {
+            fprintf(stderr, "ERROR: Invalid chunk state\n");
+            return -1; 
+        } break; 
+    }
+    return 0; 
+}
+
+
+// Binning of setup_particles. Every task takes a contiguous range of slots 
+// and counts, then scatters, the chunks each of its particles overlaps. 
+// Ranges are in slot order, so every chunk list comes out sorted by slot. 
+typedef struct {
+    Chunkmap* chunkmap; 
+    uint32_t tasks; 
+    uint32_t* counts;   // tasks * chunks, count and then write cursor of task t for chunk c 
+    uint32_t* binned;   // particle slots grouped by chunk (c = i * chunks_y + j) 
+    bool scatter; 
+} SetupBinJob; 
+
+
+// Chunk range of the box of p, clamped to the grid. One chunk wider than 
+// floor() on each side when the neighbour touches the box, box_overlap 
+// makes the final call. 
+static inline void setup_particle_range(Chunkmap* chunkmap, Box box, uint32_t* i0, uint32_t* i1, uint32_t* j0, uint32_t* j1) {
+    Chunk*** chunks = chunkmap->chunks; 
+    int32_t nx = chunkmap->chunks_x, ny = chunkmap->chunks_y; 
+    int32_t il = floorf(box.l / chunkmap->chunks_size.x), ir = floorf(box.r / chunkmap->chunks_size.x); 
+    int32_t jb = floorf(box.b / chunkmap->chunks_size.y), jt = floorf(box.t / chunkmap->chunks_size.y); 
+    il = il < 0 ? 0 : (il >= nx ? nx - 1 : il); 
+    ir = ir < 0 ? 0 : (ir >= nx ? nx - 1 : ir); 
+    jb = jb < 0 ? 0 : (jb >= ny ? ny - 1 : jb); 
+    jt = jt < 0 ? 0 : (jt >= ny ? ny - 1 : jt); 
+    if (il > 0 && chunks[il-1][0]->box.r >= box.l) il--; 
+    if (ir < nx - 1 && chunks[ir+1][0]->box.l <= box.r) ir++; 
+    if (jb > 0 && chunks[0][jb-1]->box.t >= box.b) jb--; 
+    if (jt < ny - 1 && chunks[0][jt+1]->box.b <= box.t) jt++; 
+    *i0 = il; 
+    *i1 = ir; 
+    *j0 = jb; 
+    *j1 = jt; 
+}
+
+
+static void setup_job_bin(void* ctx, uint32_t task, uint32_t thread) {
+    SetupBinJob* job = ctx; 
+    Chunkmap* chunkmap = job->chunkmap; 
+    Particles* ps = &chunkmap->particles; 
+    uint32_t n_chunks = chunkmap->chunks_x * chunkmap->chunks_y; 
+    uint32_t* counts = job->counts + (size_t) task * n_chunks; 
+    uint32_t begin = (uint64_t) chunkmap->particles_n * task / job->tasks; 
+    uint32_t end = (uint64_t) chunkmap->particles_n * (task + 1) / job->tasks; 
+    for (uint32_t p = begin; p < end; p++) {
+        Box box = particle_box(ps, p); 
+        uint32_t i0, i1, j0, j1; 
+        setup_particle_range(chunkmap, box, &i0, &i1, &j0, &j1); 
+        for (uint32_t i = i0; i <= i1; i++) {
+            for (uint32_t j = j0; j <= j1; j++) {
+                if (!box_overlap(box, chunkmap->chunks[i][j]->box)) continue; 
+                uint32_t c = i * chunkmap->chunks_y + j; 
+                if (job->scatter) {
+                    job->binned[counts[c]++] = p; 
+                } else {
+                    counts[c]++; 
+                }
+            }
+        }
+    }
+}
+
+
+static void setup_bin_run(Threadpool* pool, SetupBinJob* job) {
+    if (pool != NULL) {
+        threadpool_run(pool, setup_job_bin, job, job->tasks); 
+    } else {
+        setup_job_bin(job, 0, 0); 
+    }
+}
+
+
+int setup_particles(Chunkmap* chunkmap, float particle_radius, float speed, Container* container) {
+    float pad = 1.0f * particle_radius; 
+    uint32_t particles_per_row, particles_per_col; 
+    particles_lattice(container, particle_radius, &particles_per_row, &particles_per_col); 
+
+    uint32_t n_max = particles_per_row*particles_per_col;
+    if (chunkmap->particles_n > n_max) {
+        fprintf(stderr, "Too many particles %d for container %d\n", chunkmap->particles_n, n_max); 
+        return -1; 
+    }
+
+    Particles* ps = &chunkmap->particles; 
+    float v_start = speed;  
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) { 
+        uint32_t col = p%particles_per_row;
+        uint32_t row = (uint32_t) (p/particles_per_row);
+        ps->x[p] = (particle_radius + pad)*(1.0f + 2.0f*col); 
+        ps->y[p] = (particle_radius + pad)*(1.0f + 2.0f*row); 
+
+        ps->vx[p] = rand_float(-v_start, v_start); 
+        ps->vy[p] = rand_float(-v_start, v_start); 
+
+        ps->dpos_x[p] = 0.0f; 
+        ps->dpos_y[p] = 0.0f; 
+        ps->partner[p] = UINT32_MAX; 
+        ps->overlap[p] = 0.0f; 
+        ps->rad[p] = particle_radius;
+        ps->mass[p] = 1.0f; 
+        ps->id[p] = p; 
+        chunkmap->id_slot[p] = p; 
+    }
+
+    // Every particle goes through the chunks it overlaps in the order the 
+    // chunks are visited, which is what the old all chunks x all particles 
+    // box_overlap loop did. Same chunk lists, same refs, in O(n). 
+    Threadpool* pool = chunkmap->threadpool; 
+    uint32_t n_chunks = chunkmap->chunks_x * chunkmap->chunks_y; 
+    SetupBinJob job = {
+        .chunkmap = chunkmap, 
+        .tasks = pool != NULL ? pool->threads : 1, 
+    }; 
+    uint32_t* chunk_start = malloc((n_chunks + 1) * sizeof chunk_start[0]); 
+    job.counts = calloc((size_t) job.tasks * n_chunks, sizeof job.counts[0]); 
+    if (chunk_start == NULL || job.counts == NULL) {
+        fprintf(stderr, "ERROR: malloc of setup bins failed.\n"); 
+        free(chunk_start); 
+        free(job.counts); 
+        return -1; 
+    }
+    job.scatter = false; 
+    setup_bin_run(pool, &job); 
+    // counts -> write cursors, task t starts behind tasks 0..t-1 in every chunk 
+    uint32_t offset = 0; 
+    for (uint32_t c = 0; c < n_chunks; c++) {
+        chunk_start[c] = offset; 
+        for (uint32_t t = 0; t < job.tasks; t++) {
+            uint32_t count = job.counts[(size_t) t * n_chunks + c]; 
+            job.counts[(size_t) t * n_chunks + c] = offset; 
+            offset += count; 
+        }
+    }
+    chunk_start[n_chunks] = offset; 
+    job.binned = malloc((size_t) offset * sizeof job.binned[0]); 
+    if (job.binned == NULL) {
+        fprintf(stderr, "ERROR: malloc of setup bins failed.\n"); 
+        free(chunk_start); 
+        free(job.counts); 
+        return -1; 
+    }
+    job.scatter = true; 
+    setup_bin_run(pool, &job); 
+
+    int result = 0; 
+    for (uint32_t i = 0; i < chunkmap->chunks_x && result == 0; i++) {
+        for (uint32_t j = 0; j < chunkmap->chunks_y && result == 0; j++) {
+            uint32_t c = i * chunkmap->chunks_y + j; 
+            for (uint32_t k = chunk_start[c]; k < chunk_start[c+1] && result == 0; k++) {
+                result = setup_particle_chunk(ps, job.binned[k], chunkmap->chunks[i][j]); 
+            }
+        } 
+    } 
+    free(chunk_start); 
+    free(job.counts); 
+    free(job.binned); 
+    return result; 
+}
+
+
+void setup_chunk(Chunkmap* chunkmap, uint32_t i, uint32_t j) {
+    Chunk* chunk = chunkmap->chunks[i][j]; 
+    chunk->particles = (uint32_t*)((char*)chunk + sizeof *chunk); 
+    memset(chunk->particles, 0xff, chunkmap->particles_max_per_chunk * sizeof chunk->particles[0]);
+    chunk->box.l = i*chunkmap->chunks_size.x; 
+    chunk->box.r = (i+1)*chunkmap->chunks_size.x;
+    chunk->box.b = j*chunkmap->chunks_size.y;
+    chunk->box.t = (j+1)*chunkmap->chunks_size.y;
+    chunk->particles_filled = 0; 
+    chunk->particles_free = chunkmap->particles_max_per_chunk;
+    chunk->x = i; 
+    chunk->y = j; 
+}
+
+
+size_t particles_memory_size(uint32_t n) {
+    Particles* ps = NULL; 
+    return 
+        9 * align_up(n * sizeof ps->x[0], PS_ALIGN) +
+        align_up(n * sizeof ps->chunk_refs[0], PS_ALIGN) + 
+        align_up(n * sizeof ps->partner[0], PS_ALIGN) + 
+        align_up(n * sizeof ps->chunk_state[0], PS_ALIGN) + 
+        align_up(n * sizeof ps->id[0], PS_ALIGN); 
+}
+
+
+// Carves the particle columns out of mem, which must be PS_ALIGN aligned. 
+// Returns the first byte after the columns. 
+char* particles_carve(Particles* ps, char* mem, uint32_t n) {
+#define carve_column(_column) \
+    ps->_column = (void*)mem; \
+    mem += align_up(n * sizeof ps->_column[0], PS_ALIGN)
+
+    carve_column(x); 
+    carve_column(y); 
+    carve_column(rad); 
+    carve_column(vx); 
+    carve_column(vy); 
+    carve_column(dpos_x); 
+    carve_column(dpos_y); 
+    carve_column(partner); 
+    carve_column(mass); 
+    carve_column(overlap); 
+    carve_column(chunk_refs); 
+    carve_column(chunk_state); 
+    carve_column(id); 
+#undef carve_column
+    return mem; 
+}
+
+
+// a chunk is followed by its particle index list, keep the next chunk pointer aligned 
+static size_t chunk_stride(Chunkmap* chunkmap) {
+    return align_up(sizeof *chunkmap->chunks[0][0] + chunkmap->particles_max_per_chunk * sizeof chunkmap->chunks[0][0]->particles[0], sizeof(void*)); 
+}
+
+
+static size_t chunks_memory_size(Chunkmap* chunkmap) {
+    uint32_t nx = chunkmap->chunks_x; 
+    uint32_t ny = chunkmap->chunks_y; 
+    return align_up(
+        nx * sizeof chunkmap->chunks[0] +
+        nx * ny * sizeof chunkmap->chunks[0][0] +
+        nx * ny * chunk_stride(chunkmap), PS_ALIGN);  
+}
+
+
+// Neighbour pointers of the chunks, NULL at a wall, wrapped around a 
+// periodic axis. 
+static void chunks_link(Chunkmap* chunkmap) {
+    uint32_t nx = chunkmap->chunks_x; 
+    uint32_t ny = chunkmap->chunks_y; 
+    bool wrap_x = chunkmap->boundary_x == BOUNDARY_PERIODIC; 
+    bool wrap_y = chunkmap->boundary_y == BOUNDARY_PERIODIC; 
+    Chunk*** chunks = chunkmap->chunks; 
+    for (uint32_t i = 0; i < nx; i++) {
+        for (uint32_t j = 0; j < ny; j++) {
+            chunks[i][j]->left = i == 0 ? (wrap_x ? chunks[nx-1][j] : NULL) : chunks[i-1][j]; 
+            chunks[i][j]->right = i == nx-1 ? (wrap_x ? chunks[0][j] : NULL) : chunks[i+1][j]; 
+            chunks[i][j]->bottom = j == 0 ? (wrap_y ? chunks[i][ny-1] : NULL) : chunks[i][j-1]; 
+            chunks[i][j]->top = j == ny-1 ? (wrap_y ? chunks[i][0] : NULL) : chunks[i][j+1]; 
+        }
+    }
+}
+
+
+// Lays out the chunk grid of chunkmap (chunks_x, chunks_y, particles_max_per_chunk) 
+// in mem, all chunks empty. 
+static void chunks_carve(Chunkmap* chunkmap, char* mem) {
+    uint32_t nx = chunkmap->chunks_x; 
+    uint32_t ny = chunkmap->chunks_y; 
+    size_t stride = chunk_stride(chunkmap); 
+    Chunk*** chunks = (Chunk***)mem; 
+    chunkmap->chunks = chunks; 
+    chunks[0] = (Chunk**)((char*)chunks + nx * sizeof chunkmap->chunks[0]); 
+    chunks[0][0] = (Chunk*)((char*)chunks[0] + nx * ny * sizeof chunks[0]); 
+    setup_chunk(chunkmap, 0, 0); 
+    for (uint32_t i = 1; i < nx; i++) {
+        chunks[i] = (Chunk**)((char*)chunks[i-1] + ny * sizeof chunks[0]); 
+        chunks[i][0] = (Chunk*)((char*)chunks[i-1][0] + ny * stride);
+        setup_chunk(chunkmap, i, 0); // 1,0 2,0 3,0  
+    }
+    for (uint32_t i = 0; i < nx; i++) {
+        for (uint32_t j = 1; j < ny; j++) {
+            chunks[i][j] = (Chunk*)((char*)chunks[i][j-1] + stride); 
+            setup_chunk(chunkmap, i, j); // 0,1 0,2 0,3 ... 1,1 1,2,1,3 ... 2,1 
+        }
+    }
+    chunks_link(chunkmap); 
+}
+
+
+int setup_simulation_memory(void** mem_block_ptr, Chunkmap* chunkmap) {
+    size_t chunks_size = chunks_memory_size(chunkmap); 
+    uint32_t n_cells = chunkmap->celllist.cells_x * chunkmap->celllist.cells_y; 
+    size_t celllist_size = 
+        align_up((n_cells + 1) * sizeof chunkmap->celllist.cell_start[0], PS_ALIGN) + 
+        align_up(n_cells * sizeof chunkmap->celllist.cell_fill[0], PS_ALIGN) + 
+        2 * align_up(chunkmap->particles_n * sizeof chunkmap->celllist.cell_particles[0], PS_ALIGN); 
+    size_t id_slot_size = align_up(chunkmap->particles_n * sizeof chunkmap->id_slot[0], PS_ALIGN); 
+    size_t total_size = chunks_size + particles_memory_size(chunkmap->particles_n) + celllist_size + id_slot_size; 
+
+    char* mem_block = aligned_alloc(PS_ALIGN, total_size);
+    if (mem_block == NULL) {
+        fprintf(stderr, "ERROR: malloc of memory block (size=%zu) failed.\n", total_size);
+        return -1;
+    }
+    printf("Allocated %zu bytes on heap.\n", total_size);
+    *mem_block_ptr = mem_block;
+    chunks_carve(chunkmap, mem_block); 
+    char* mem = particles_carve(&chunkmap->particles, mem_block + chunks_size, chunkmap->particles_n); 
+    Celllist* cl = &chunkmap->celllist; 
+    cl->cell_start = (uint32_t*)mem; 
+    mem += align_up((n_cells + 1) * sizeof cl->cell_start[0], PS_ALIGN); 
+    cl->cell_fill = (uint32_t*)mem; 
+    mem += align_up(n_cells * sizeof cl->cell_fill[0], PS_ALIGN); 
+    cl->cell_particles = (uint32_t*)mem; 
+    mem += align_up(chunkmap->particles_n * sizeof cl->cell_particles[0], PS_ALIGN); 
+    cl->particle_cell = (uint32_t*)mem; 
+    mem += align_up(chunkmap->particles_n * sizeof cl->particle_cell[0], PS_ALIGN); 
+    chunkmap->id_slot = (uint32_t*)mem; 
+
+    memset(chunkmap->particles.chunk_refs, 0, chunkmap->particles_n * sizeof chunkmap->particles.chunk_refs[0]); 
+    memset(chunkmap->particles.chunk_state, 0, chunkmap->particles_n * sizeof chunkmap->particles.chunk_state[0]); 
+    return 0; 
+}
+
+
+// chunk count, size and capacity, needs chunkmap->dimensions 
+static void chunkmap_grid(Chunkmap* chunkmap, uint32_t chunks_x, uint32_t chunks_y, float particle_radius) {
+    chunkmap->chunks_x = chunks_x; 
+    chunkmap->chunks_y = chunks_y; 
+    chunkmap->chunks_size.x = chunkmap->dimensions.x / chunkmap->chunks_x; 
+    chunkmap->chunks_size.y = chunkmap->dimensions.y / chunkmap->chunks_y; 
+    chunkmap->particles_max_per_chunk = new_max(2 * chunkmap->chunks_size.x * chunkmap->chunks_size.y / (particle_radius * particle_radius), 100); 
+}
+
+
+void chunkmap_init(Chunkmap* chunkmap, Container* container, uint32_t chunks_x, uint32_t chunks_y, uint32_t particles_n, float particle_radius) {
+    chunkmap->dimensions.x = (float) container->width;
+    chunkmap->dimensions.y = (float) container->height;
+    chunkmap_grid(chunkmap, chunks_x, chunks_y, particle_radius); 
+    chunkmap->particles_n = particles_n; 
+    chunkmap->collide_kernel = collide_kernel_detect(); 
+    // cells of one particle diameter, so the 3x3 neighbourhood covers every contact 
+    Celllist* cl = &chunkmap->celllist; 
+    cl->cells_x = new_max((uint32_t)(container->width / (2 * particle_radius)), 1); 
+    cl->cells_y = new_max((uint32_t)(container->height / (2 * particle_radius)), 1); 
+    cl->cell_size.x = (float) container->width / cl->cells_x; 
+    cl->cell_size.y = (float) container->height / cl->cells_y; 
+    cl->reach_x = 1; 
+    cl->reach_y = 1; 
+}
+
+
+// Particles per area of the chunks that hold any, so empty space does not 
+// count. Only comparable between two calls on the same grid. 
+float chunkmap_density(Chunkmap* chunkmap) {
+    uint32_t occupied = 0; 
+    for (uint32_t i = 0; i < chunkmap->chunks_x; i++) {
+        for (uint32_t j = 0; j < chunkmap->chunks_y; j++) {
+            occupied += chunkmap->chunks[i][j]->particles_filled > 0; 
+        }
+    }
+    if (occupied == 0) return 0.0f; 
+    return chunkmap->particles_n / (occupied * chunkmap->chunks_size.x * chunkmap->chunks_size.y); 
+}
+
+
+// Replaces the chunk grid by a chunks_x * chunks_y one and bins every 
+// particle into it. The new grid gets its own block, the one from 
+// setup_simulation_memory stays in place until the caller frees it. 
+int chunkmap_regrid(Chunkmap* chunkmap, uint32_t chunks_x, uint32_t chunks_y, float particle_radius) {
+    float extent = 2 * (particle_radius + chunkmap->sweep_margin); 
+    if (chunks_x == 0 || chunks_y == 0 || chunkmap->dimensions.x / chunks_x < extent || chunkmap->dimensions.y / chunks_y < extent) {
+        fprintf(stderr, "ERROR: regrid to %dx%d chunks, chunks must be at least one particle wide\n", chunks_x, chunks_y);
+        return -1; 
+    }
+    if ((chunkmap->boundary_x == BOUNDARY_PERIODIC && chunks_x < 3) || (chunkmap->boundary_y == BOUNDARY_PERIODIC && chunks_y < 3)) {
+        fprintf(stderr, "ERROR: regrid to %dx%d chunks, a periodic axis needs at least 3 chunks\n", chunks_x, chunks_y);
+        return -1; 
+    }
+    Chunkmap grid = *chunkmap; 
+    chunkmap_grid(&grid, chunks_x, chunks_y, particle_radius); 
+    size_t size = chunks_memory_size(&grid); 
+    void* block = aligned_alloc(PS_ALIGN, size); 
+    if (block == NULL) {
+        fprintf(stderr, "ERROR: malloc of chunk grid (size=%zu) failed.\n", size);
+        return -1; 
+    }
+    chunks_carve(&grid, block); 
+    free(chunkmap->chunks_block); 
+    chunkmap->chunks_block = block; 
+    chunkmap->chunks = grid.chunks; 
+    chunkmap->chunks_x = grid.chunks_x; 
+    chunkmap->chunks_y = grid.chunks_y; 
+    chunkmap->chunks_size = grid.chunks_size; 
+    chunkmap->particles_max_per_chunk = grid.particles_max_per_chunk; 
+
+    Particles* ps = &chunkmap->particles; 
+    memset(ps->chunk_refs, 0, chunkmap->particles_n * sizeof ps->chunk_refs[0]); 
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        uint32_t i, j; 
+        ChunkState state; 
+        particle_chunk_range(chunkmap, ps, p, particle_radius + chunkmap->sweep_margin, UINT32_MAX, UINT32_MAX, &i, &j, &state); 
+        particle_chunk_apply(chunkmap, ps, p, i, j, state); 
+    }
+    chunkmap->regrid_density = chunkmap_density(chunkmap); 
+    chunkmap->regrids++; 
+    return 0; 
+}
+
+
+// Overlap or swept collisions and the cfl cap on dt, any time after 
+// setup_simulation_memory. Swept collisions need pairs that meet within the 
+// tick to share a chunk (cell, list), so the chunks must hold the particle 
+// widened by the sweep margin on both sides and the cell stencils reach 
+// further. cfl <= 1 also keeps a mirrored wall bounce inside the container. 
+int chunkmap_set_collide_mode(Chunkmap* chunkmap, CollideMode collide_mode, float cfl, float particle_radius) {
+    Celllist* cl = &chunkmap->celllist; 
+    bool swept = collide_mode == COLLIDE_MODE_SWEPT; 
+    if (swept && !(cfl > 0.0f && cfl <= 1.0f)) {
+        fprintf(stderr, "ERROR: swept collisions need a cfl in (0, 1], not %g\n", cfl);
+        return -1; 
+    }
+    float margin = swept ? cfl * particle_radius : 0.0f; 
+    float extent = 2 * (particle_radius + margin); 
+    if (chunkmap->chunks_size.x < extent || chunkmap->chunks_size.y < extent) {
+        fprintf(stderr, "ERROR: %s collisions need chunks of at least %.2f, have %.2fx%.2f\n", collide_mode_to_name(collide_mode), extent, vec2_unpack(chunkmap->chunks_size));
+        return -1; 
+    }
+    uint32_t reach_x = (uint32_t) ceilf(extent / cl->cell_size.x); 
+    uint32_t reach_y = (uint32_t) ceilf(extent / cl->cell_size.y); 
+    if ((cl->wrap_x && cl->cells_x < 2 * reach_x + 1) || (cl->wrap_y && cl->cells_y < 2 * reach_y + 1)) {
+        fprintf(stderr, "ERROR: %s collisions on a periodic axis need at least %dx%d cells\n", collide_mode_to_name(collide_mode), 2 * reach_x + 1, 2 * reach_y + 1);
+        return -1; 
+    }
+    chunkmap->collide_mode = collide_mode; 
+    chunkmap->cfl = cfl; 
+    chunkmap->sweep_margin = margin; 
+    cl->reach_x = reach_x; 
+    cl->reach_y = reach_y; 
+    chunkmap->verlet.stale = true; 
+    return 0; 
+}
+
+
+// Tick or event driven engine, any time after setup_particles. Both leave 
+// the particles at the end of their last tick, so a switch only rebuilds 
+// the state of the other one: the event queue on the way in, the verlet 
+// lists on the way out (the chunk refs catch up on their own, see 
+// chunkmap_set_spatial_index). 
+int chunkmap_set_engine(Chunkmap* chunkmap, Engine engine) {
+    if (engine >= ENGINE_COUNTER) {
+        fprintf(stderr, "ERROR: invalid engine %d\n", engine);
+        return -1; 
+    }
+    chunkmap->events.stale = true; 
+    chunkmap->verlet.stale = true; 
+    chunkmap->engine = engine; 
+    return 0; 
+}
+
+
+// Walls or periodic per axis, any time after setup_simulation_memory. A 
+// periodic axis needs 3 chunks and 2 * reach + 1 cells, with fewer the 
+// neighbours on either side of a chunk (cell) would be the same one. The 
+// chunk refs catch up in the next tick, the verlet lists are rebuilt. 
+int chunkmap_set_boundary(Chunkmap* chunkmap, Boundary boundary_x, Boundary boundary_y) {
+    Celllist* cl = &chunkmap->celllist; 
+    bool wrap_x = boundary_x == BOUNDARY_PERIODIC; 
+    bool wrap_y = boundary_y == BOUNDARY_PERIODIC; 
+    if ((wrap_x && (chunkmap->chunks_x < 3 || cl->cells_x < 2 * cl->reach_x + 1)) || (wrap_y && (chunkmap->chunks_y < 3 || cl->cells_y < 2 * cl->reach_y + 1))) {
+        fprintf(stderr, "ERROR: periodic boundaries need at least 3 chunks and 3 cells (5 with swept collisions) along the axis (%dx%d chunks, %dx%d cells)\n", chunkmap->chunks_x, chunkmap->chunks_y, cl->cells_x, cl->cells_y);
+        return -1; 
+    }
+    chunkmap->boundary_x = boundary_x; 
+    chunkmap->boundary_y = boundary_y; 
+    chunks_link(chunkmap); 
+    chunkmap->particles.period_x = wrap_x ? chunkmap->dimensions.x : 0.0f; 
+    chunkmap->particles.period_y = wrap_y ? chunkmap->dimensions.y : 0.0f; 
+    cl->wrap_x = wrap_x; 
+    cl->wrap_y = wrap_y; 
+    chunkmap->verlet.stale = true; 
+    chunkmap->events.stale = true; 
+    Virial* virial = &chunkmap->virial; 
+    for (uint32_t t = 0; virial->enabled && virial->rows != NULL && t < virial->threads; t++) {
+        virial->rows[t].wrap_x = wrap_x; 
+        virial->rows[t].wrap_y = wrap_y; 
+    }
+    return 0; 
+}
+
+
+void chunkmap_free_chunks(Chunkmap* chunkmap) {
+    free(chunkmap->chunks_block); 
+    chunkmap->chunks_block = NULL; 
+    chunkmap->chunks = NULL; 
+}
+
+
+// Every exit of a setup that got as far as chunkmap_init. The chunkmap 
+// parts are safe to free at any stage, pool is NULL before threadpool_init 
+// succeeded. 
+void chunkmap_teardown(Chunkmap* chunkmap, Threadpool* pool, void* mem_block) {
+    chunkmap_free_threadpool(chunkmap); 
+    if (pool != NULL) {
+        threadpool_destroy(pool); 
+    }
+    chunkmap_free_verlet(chunkmap); 
+    pressure_free(&chunkmap->pressure); 
+    virial_free(&chunkmap->virial); 
+    events_free(&chunkmap->events); 
+    dt_control_free(&chunkmap->dt_control); 
+    chunkmap_free_chunks(chunkmap); 
+    free(mem_block); 
+}
+
+
+static double autotune_now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// Chunk sides tried by chunkmap_autotune, in particle diameters. Below 3 
+// most particles straddle chunks and particles_max_per_chunk dominates memory. 
+static const float autotune_sides[] = { 3.0f, 4.0f, 6.0f, 8.0f, 12.0f, 16.0f, 24.0f, 32.0f }; 
+
+
+// Times `ticks` physics ticks on every candidate grid (and the current one) 
+// and keeps the fastest. The particles are put back after every candidate, 
+// so tuning does not advance the simulation. 
+int chunkmap_autotune(Chunkmap* chunkmap, uint32_t ticks, float dt, float particle_radius, Container* container) {
+    if (chunkmap->engine != ENGINE_TICK || chunkmap->spatial_index != SPATIAL_CHUNKREFS) {
+        return 0; // the chunk grid is not used 
+    }
+    uint32_t n = chunkmap->particles_n; 
+    Particles* ps = &chunkmap->particles; 
+    float* snapshot = malloc(4 * n * sizeof snapshot[0]); 
+    if (snapshot == NULL) {
+        fprintf(stderr, "ERROR: malloc of autotune snapshot failed.\n");
+        return -1; 
+    }
+    memcpy(snapshot + 0 * n, ps->x, n * sizeof snapshot[0]); 
+    memcpy(snapshot + 1 * n, ps->y, n * sizeof snapshot[0]); 
+    memcpy(snapshot + 2 * n, ps->vx, n * sizeof snapshot[0]); 
+    memcpy(snapshot + 3 * n, ps->vy, n * sizeof snapshot[0]); 
+    // no slot moves and no nested tuning while the candidates run 
+    uint64_t ticks_saved = chunkmap->ticks; 
+    double time_saved = chunkmap->time; 
+    uint32_t reorder_interval = chunkmap->reorder_interval; 
+    float reorder_threshold = chunkmap->reorder_threshold; 
+    float regrid_tolerance = chunkmap->regrid_tolerance; 
+    uint32_t regrids = chunkmap->regrids; 
+    uint32_t pressure_segments = chunkmap->pressure.segments; 
+    chunkmap->reorder_interval = 0; 
+    chunkmap->reorder_threshold = 0.0f; 
+    chunkmap->regrid_tolerance = 0.0f; 
+    bool virial_enabled = chunkmap->virial.enabled; 
+    chunkmap->pressure.segments = 0; // the trial ticks are thrown away, so are their bounces 
+    chunkmap->virial.enabled = false; // and their contacts 
+    bool dt_control_enabled = chunkmap->dt_control.enabled; 
+    chunkmap->dt_control.enabled = false; // the candidates all run at dt 
+
+    uint32_t candidates_n = sizeof autotune_sides / sizeof autotune_sides[0] + 1; 
+    uint32_t start_x = chunkmap->chunks_x, start_y = chunkmap->chunks_y; 
+    uint32_t last_x = 0, last_y = 0; 
+    uint32_t best_x = start_x, best_y = start_y; 
+    double best_ns = INFINITY; 
+    int result = 0; 
+    for (uint32_t c = 0; c < candidates_n && result == 0; c++) {
+        // candidate 0 is the current grid 
+        uint32_t cx = start_x, cy = start_y; 
+        if (c > 0) {
+            float side = autotune_sides[c - 1] * 2 * particle_radius; 
+            cx = new_max((uint32_t)(chunkmap->dimensions.x / side), chunkmap->boundary_x == BOUNDARY_PERIODIC ? 3 : 1); 
+            cy = new_max((uint32_t)(chunkmap->dimensions.y / side), chunkmap->boundary_y == BOUNDARY_PERIODIC ? 3 : 1); 
+            if ((cx == last_x && cy == last_y) || (cx == start_x && cy == start_y)) continue; 
+        }
+        last_x = cx; 
+        last_y = cy; 
+        if (chunkmap_regrid(chunkmap, cx, cy, particle_radius) < 0) {
+            result = -1; 
+            break; 
+        }
+        // the first tick is untimed, it pays for the cold chunk lists 
+        double t0 = 0.0; 
+        for (uint32_t t = 0; t <= ticks && result == 0; t++) {
+            if (t == 1) t0 = autotune_now_s(); 
+            result = physics_tick(dt, chunkmap, particle_radius, container); 
+        }
+        double ns = (autotune_now_s() - t0) * 1e9 / ((double) new_max(ticks, 1) * n); 
+        printf("autotune: %dx%d chunks (%.1fx%.1f) %.2f ns/particle-tick\n", cx, cy, vec2_unpack(chunkmap->chunks_size), ns); 
+        if (ns < best_ns) {
+            best_ns = ns; 
+            best_x = cx; 
+            best_y = cy; 
+        }
+        memcpy(ps->x, snapshot + 0 * n, n * sizeof snapshot[0]); 
+        memcpy(ps->y, snapshot + 1 * n, n * sizeof snapshot[0]); 
+        memcpy(ps->vx, snapshot + 2 * n, n * sizeof snapshot[0]); 
+        memcpy(ps->vy, snapshot + 3 * n, n * sizeof snapshot[0]); 
+    }
+    free(snapshot); 
+    chunkmap->ticks = ticks_saved; 
+    chunkmap->time = time_saved; 
+    chunkmap->reorder_interval = reorder_interval; 
+    chunkmap->reorder_threshold = reorder_threshold; 
+    chunkmap->regrid_tolerance = regrid_tolerance; 
+    chunkmap->pressure.segments = pressure_segments; 
+    chunkmap->virial.enabled = virial_enabled; 
+    chunkmap->dt_control.enabled = dt_control_enabled; 
+    memset(ps->overlap, 0, n * sizeof ps->overlap[0]); // left over from the candidates 
+    if (result < 0) {
+        return result; 
+    }
+    // rebinds the restored positions even if the grid stays the same 
+    result = chunkmap_regrid(chunkmap, best_x, best_y, particle_radius); 
+    chunkmap->regrids = regrids + 1; 
+    printf("autotune: chose %dx%d chunks (%.1fx%.1f, %.1f particles per chunk) at %.2f ns/particle-tick\n", best_x, best_y, vec2_unpack(chunkmap->chunks_size), chunkmap->regrid_density * chunkmap->chunks_size.x * chunkmap->chunks_size.y, best_ns); 
+    return result; 
+}
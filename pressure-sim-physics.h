@@ -0,0 +1,633 @@
+#ifndef PS_PHYSICS_H_
+#define PS_PHYSICS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "pressure-sim-threadpool.h"
+
+#define vec2_unpack(_vec) ((_vec).x), ((_vec).y)
+#define box_unpack(_box) ((_box).l), ((_box).r), ((_box).t), ((_box).b)
+#define box_overlap(_b1, _b2) ((_b1).r >= (_b2).l && (_b1).l <= (_b2).r && (_b1).t >= (_b2).b && (_b1).b <= (_b2).t) 
+#define new_max(x,y) (((x) >= (y)) ? (x) : (y))
+#define new_min(x,y) (((x) <= (y)) ? (x) : (y))
+#define align_up(_n, _a) (((_n) + (_a) - 1) & ~((size_t)(_a) - 1))
+
+#define PS_ALIGN 64 // cache line, every particle column starts on one
+#define AUTOTUNE_TICKS 8 // default ticks per candidate of chunkmap_autotune 
+
+
+typedef struct {
+    uint32_t width, height; 
+    float zoom, inverse_aspect_ratio, scalar; 
+} Container; 
+
+
+// Packed float2, the shaders use the scalar layout. 
+typedef struct {
+    float x, y; // gpu coords 
+} GPUParticle; 
+
+
+typedef struct {
+    float l, r, b, t; 
+} Box; 
+
+
+typedef struct {
+    uint32_t x, y; 
+} Vec2i; 
+
+
+typedef struct {
+    float x, y; 
+} Vec2f; 
+
+
+typedef struct {
+    float x, y, z; 
+} Vec3f; 
+
+
+typedef struct Chunk Chunk; 
+typedef struct ChunkRef ChunkRef; 
+
+typedef enum ChunkState {
+    CS_INVALID, 
+    CS_ONE,
+    CS_TB,
+    CS_LR,
+    CS_LRTB,
+    CS_COUNTER
+} ChunkState; 
+
+
+static inline const char* chunkstate_to_name(ChunkState cs) {
+    static const char *strings[] = { 
+		"CS_INVALID", 
+		"CS_ONE",
+		"CS_TB",
+		"CS_LR",
+		"CS_LRTB",
+		"CS_COUNTER"
+  	};  
+    return strings[cs];
+}
+
+
+
+struct ChunkRef {
+    Chunk* chunk;
+    uint32_t p_index; // particle index in chunk 
+}; 
+
+
+struct Chunk {
+    uint32_t* particles; // indices into Chunkmap.particles 
+    Chunk* left; 
+    Chunk* right; 
+    Chunk* bottom; 
+    Chunk* top; 
+    Box box;
+    uint32_t particles_filled; 
+    uint32_t particles_free; 
+    uint32_t x; 
+    uint32_t y; 
+}; 
+
+
+// Particles are stored as a structure of arrays, one column per field, 
+// indexed by the particle slot. The collision loop only touches the hot 
+// columns of its candidates (x, y, rad), the per particle update touches the 
+// warm ones and the chunk bookkeeping lives in the cold ones. 
+typedef struct {
+    // hot 
+    float* x; 
+    float* y; 
+    float* rad; 
+    // warm 
+    float* vx; 
+    float* vy; 
+    float* dpos_x; 
+    float* dpos_y; 
+    uint32_t* partner; // PAIRS_JACOBI contact p swaps velocities with, UINT32_MAX if none 
+    float* overlap;    // deepest overlap collide found for p, read and cleared by the dt controller 
+    // cold 
+    float* mass; 
+    ChunkRef (*chunk_refs)[4]; 
+    ChunkState* chunk_state;
+    uint32_t* id; 
+    // container size along the periodic axes, 0 along walls, see Boundary 
+    float period_x; 
+    float period_y; 
+    // tick length while the collisions are swept, 0 = overlap test, see CollideMode 
+    float sweep_dt; 
+} Particles; 
+
+
+// Separation d of two particles along an axis with the given period, as its 
+// shortest image. period 0 (walls) leaves d alone. 
+static inline float min_image(float d, float period) {
+    if (period > 0.0f) {
+        if (d > 0.5f * period) d -= period; 
+        else if (d < -0.5f * period) d += period; 
+    }
+    return d; 
+}
+
+
+
+typedef enum {
+    SPATIAL_CHUNKREFS, // ChunkRef/ChunkState membership, updated incrementally 
+    SPATIAL_CELLLIST,  // counting sort cell list, rebuilt every tick 
+    SPATIAL_VERLET,    // neighbour lists with a skin, rebuilt when the particles moved too far 
+    SPATIAL_COUNTER
+} SpatialIndex; 
+
+
+// What happens at the container sides, per axis. A periodic axis glues the 
+// last chunk column (row) to the first one: the chunk neighbours wrap, a 
+// particle leaving on one side comes back on the other and a particle on the 
+// seam is a member of the chunks on both sides. 
+typedef enum {
+    BOUNDARY_WALLS, 
+    BOUNDARY_PERIODIC, 
+    BOUNDARY_COUNTER
+} Boundary; 
+
+
+static inline const char* boundary_to_name(Boundary b) {
+    static const char *strings[] = { 
+        "walls", 
+        "periodic", 
+        "BOUNDARY_COUNTER"
+    };  
+    return strings[b];
+}
+
+
+static inline const char* spatial_index_to_name(SpatialIndex si) {
+    static const char *strings[] = { 
+        "chunkrefs", 
+        "celllist", 
+        "verlet", 
+        "SPATIAL_COUNTER"
+    };  
+    return strings[si];
+}
+
+
+typedef enum {
+    PAIRS_ALL,       // every particle tests all of its neighbours, only p1 of collide is pushed 
+    PAIRS_SYMMETRIC, // every unordered pair once, both particles get the response 
+    PAIRS_JACOBI,    // every particle reads the previous tick and only writes itself, order independent 
+    PAIRS_COUNTER
+} PairMode; 
+
+
+// How contacts are found. overlap: the pairs that intersect at the start of 
+// the tick. swept: the pairs whose circles meet at some time within the 
+// tick (continuous collision detection), they collide at that time of 
+// impact, see collide_swept. Swept visits every pair once, so it needs 
+// PAIRS_SYMMETRIC, and a cfl cap on dt that bounds how far a particle gets 
+// in one tick. 
+typedef enum {
+    COLLIDE_MODE_OVERLAP, 
+    COLLIDE_MODE_SWEPT, 
+    COLLIDE_MODE_COUNTER
+} CollideMode; 
+
+
+static inline const char* collide_mode_to_name(CollideMode cm) {
+    static const char *strings[] = { 
+        "overlap", 
+        "swept", 
+        "COLLIDE_MODE_COUNTER"
+    };  
+    return strings[cm];
+}
+
+
+// What advances the particles. tick: physics_tick moves everyone by dt and 
+// resolves the contacts through the spatial index. events: event driven 
+// hard disks, see pressure-sim-events.c, every collision, wall bounce and 
+// cell crossing is processed at its exact time, so the cost follows the 
+// number of events instead of particles times ticks. 
+typedef enum {
+    ENGINE_TICK, 
+    ENGINE_EVENTS, 
+    ENGINE_COUNTER
+} Engine; 
+
+
+static inline const char* engine_to_name(Engine e) {
+    static const char *strings[] = { 
+        "tick", 
+        "events", 
+        "ENGINE_COUNTER"
+    };  
+    return strings[e];
+}
+
+
+static inline const char* pair_mode_to_name(PairMode pm) {
+    static const char *strings[] = { 
+        "all", 
+        "symmetric", 
+        "jacobi", 
+        "PAIRS_COUNTER"
+    };  
+    return strings[pm];
+}
+
+
+// Narrow phase overlap test, see pressure-sim-collide.c. 
+typedef enum {
+    COLLIDE_SCALAR, 
+    COLLIDE_SSE,    // 4 lanes 
+    COLLIDE_AVX2,   // 8 lanes 
+    COLLIDE_AVX512, // 16 lanes 
+    COLLIDE_COUNTER
+} CollideKernel; 
+
+
+static inline const char* collide_kernel_to_name(CollideKernel ck) {
+    static const char *strings[] = { 
+        "scalar", 
+        "sse", 
+        "avx2", 
+        "avx512", 
+        "COLLIDE_COUNTER"
+    };  
+    return strings[ck];
+}
+
+#define COLLIDE_BLOCK 64 // candidates per collide_hits call 
+
+
+// CSR layout over a grid of cells that are at least one particle diameter 
+// wide, independent of the chunk grid. cell key = y * cells_x + x. 
+typedef struct {
+    uint32_t cells_x; 
+    uint32_t cells_y; 
+    Vec2f cell_size; 
+    uint32_t* cell_start;     // cells_x * cells_y + 1 
+    uint32_t* cell_fill;      // scatter cursor per cell 
+    uint32_t* cell_particles; // particle slots sorted by cell 
+    uint32_t* particle_cell;  // cell key per particle slot 
+    bool wrap_x, wrap_y;      // periodic axes, the stencils wrap around 
+    uint32_t reach_x, reach_y; // cells the stencils reach on each side, 1 unless swept collisions need more 
+} Celllist; 
+
+
+// Neighbour lists of SPATIAL_VERLET, built from the cell list. The list of 
+// the k-th sorted cell list slot holds every slot that was within 
+// 2 * radius + skin of it at the last build (PAIRS_SYMMETRIC: only the ones 
+// sorted after it). They hold every contact until some particle has moved 
+// more than skin/2 since the build. 
+typedef struct {
+    float skin; 
+    uint32_t* start;      // particles_n + 1, list of k is neighbours[start[k] .. start[k+1]) 
+    uint32_t* neighbours; 
+    uint32_t capacity;    // entries allocated in neighbours 
+    float* x0;            // positions at the last build, by slot 
+    float* y0; 
+    bool stale;           // slots moved or the index was switched, rebuild on the next tick 
+    bool half;            // built for PAIRS_SYMMETRIC, a pair mode switch rebuilds 
+    uint32_t builds; 
+} Verlet; 
+
+
+typedef struct {
+    double t;                 // time of the next event of slot 
+    uint32_t slot; 
+} EventEntry; 
+
+
+// State of ENGINE_EVENTS, see pressure-sim-events.c. Every slot has its own 
+// clock, the position at that time and its next event, the heap orders the 
+// slots by the event time. A pair event remembers the partner's collision 
+// count, if the partner collided since, the event is dropped when it comes 
+// up (lazy invalidation). Indexed by slot, a reorder rebuilds it. 
+typedef struct {
+    uint32_t n;               // slots allocated 
+    uint32_t cells_x; 
+    uint32_t cells_y; 
+    double cell_w, cell_h; 
+    uint32_t* cell_head;      // first slot of every cell, UINT32_MAX = empty 
+    uint32_t* cell_next;      // doubly linked list of every cell, by slot 
+    uint32_t* cell_prev; 
+    uint32_t* cell;           // cell key of every slot 
+    double* x;                // position at the slot clock 
+    double* y; 
+    double* t;                // slot clock 
+    uint32_t* event_other;    // partner slot or one of the EVENT_ codes 
+    uint32_t* event_count;    // count of the partner when the event was predicted 
+    uint32_t* count;          // velocity changes of every slot 
+    EventEntry* heap;         // binary heap on the event time 
+    uint32_t* heap_pos;       // where every slot sits in the heap 
+    bool stale;               // the particles changed outside of it, rebuild before the next advance 
+    uint64_t events;          // processed, counted since the last build 
+    uint64_t collisions; 
+    uint64_t invalid;         // pair events dropped because the partner collided first 
+} Events; 
+
+
+typedef enum {
+    WALL_LEFT, 
+    WALL_RIGHT, 
+    WALL_BOTTOM, 
+    WALL_TOP, 
+    WALL_COUNTER
+} Wall; 
+
+
+static inline const char* wall_to_name(Wall wall) {
+    static const char *strings[] = { 
+        "left", 
+        "right", 
+        "bottom", 
+        "top", 
+        "WALL_COUNTER"
+    };  
+    return strings[wall];
+}
+
+
+// Pressure on the container walls, see pressure-sim-pressure.c. 
+// particle_walls adds the momentum of every bounce to the segment of the wall 
+// it hits, in the row of the thread that runs it. pressure_tick folds the 
+// rows into a window of ticks and every finished window becomes a sample in 
+// the history ring. Pressure is force per wall length (2D). 
+typedef struct {
+    uint32_t segments;         // per wall, 0 = off 
+    uint32_t window;           // ticks per sample 
+    uint32_t history;          // samples kept 
+    uint32_t threads;          // rows of impulse 
+    size_t stride;             // doubles per row, rows start on their own cache line 
+    double* impulse;           // [thread * stride + wall * segments + segment] 
+    double* window_impulse;    // [wall * segments + segment] 
+    uint32_t window_ticks; 
+    double window_time; 
+    double time;               // simulated time since pressure_init 
+    float* segment_pressure;   // [wall * segments + segment] of the last sample 
+    float* history_pressure;   // [sample * (WALL_COUNTER + 1) + wall], the last column is all walls 
+    uint32_t history_n; 
+    uint32_t history_head;     // next sample goes here 
+    uint64_t samples; 
+    FILE* stream;              // every sample as a CSV line or a binary record, NULL = off 
+    bool stream_binary; 
+} WallPressure; 
+
+
+// Mean and variance over the samples in the history ring, per wall and (at 
+// WALL_COUNTER) for all walls. 
+typedef struct {
+    uint32_t samples; 
+    float last[WALL_COUNTER + 1]; 
+    float mean[WALL_COUNTER + 1]; 
+    float variance[WALL_COUNTER + 1]; 
+} PressureStats; 
+
+
+#define VIRIAL_COMPONENTS 3 // xx, xy, yy of the symmetric stress tensor 
+
+
+// One thread's share of the virial, what collide writes into. The grid is 
+// the chunk grid when the rows were sized, a regrid resizes them after the 
+// tick. 
+typedef struct {
+    double* sums;              // [(j * chunks_x + i) * VIRIAL_COMPONENTS + c] 
+    uint32_t chunks_x, chunks_y; 
+    float inv_chunk_w, inv_chunk_h; 
+    bool wrap_x, wrap_y;       // periodic axes, a pair midpoint across the seam belongs to the other side 
+} VirialRow; 
+
+
+// Stress tensor per chunk from the virial of the contacts, see 
+// pressure-sim-pressure.c. Every velocity exchange in collide adds r12 (x) J, 
+// the pair separation times the momentum handed to p1, to the chunk of the 
+// pair midpoint. virial_tick reduces the thread rows at the end of the tick, 
+// every window ticks the sums become a sample: (kinetic + virial / time) / 
+// chunk area, where the kinetic part sum m v (x) v is taken from the state at 
+// the end of the window. 
+typedef struct {
+    bool enabled; 
+    uint32_t window;           // ticks per sample 
+    uint32_t threads; 
+    uint32_t chunks_x, chunks_y; 
+    size_t stride;             // doubles per row, rows start on their own cache line 
+    double* rows_block; 
+    VirialRow* rows;           // one per thread 
+    double* window_sums;       // [chunk * VIRIAL_COMPONENTS + c] 
+    uint32_t window_ticks; 
+    double window_time; 
+    float* stress;             // [chunk * VIRIAL_COMPONENTS + c] of the last sample 
+    double* stress_sum;        // summed over the samples, for the mean field 
+    float pressure;            // (sxx + syy) / 2 over the container, last sample 
+    double pressure_sum; 
+    uint64_t samples;          // since the last resize 
+} Virial; 
+
+
+// One thread's share of the dt controller's reduction, on its own cache line. 
+typedef struct {
+    _Alignas(PS_ALIGN) float v2_max; 
+    float overlap_max; 
+} DtRow; 
+
+
+// Adaptive dt, see physics_dt. particle_walls folds the largest squared 
+// speed and the deepest overlap collide left behind into the row of its 
+// thread, so the reduction costs no pass of its own. After every tick the 
+// next dt is capped to one radius per tick at the largest speed, grows 
+// while the overlaps stay well below the target and shrinks in proportion 
+// once they pass it, always within dt_min and the dt physics_tick gets. 
+typedef struct {
+    bool enabled; 
+    float dt;                  // next tick, 0 until the first tick 
+    float dt_min; 
+    float overlap_target;      // deepest overlap per tick, in radii 
+    uint32_t threads; 
+    DtRow* rows; 
+    float v_max;               // reduced over the last tick 
+    float overlap_max;         // in radii 
+    uint32_t shrinks;          // ticks after which dt had to shrink 
+    FILE* log;                 // tick, time, dt, v_max, overlap of every tick as CSV, NULL = off 
+} DtControl; 
+
+
+// A chunk membership change found by a worker thread, applied after the 
+// parallel phase. (i,j) is the bottom left chunk. 
+typedef struct {
+    uint32_t p; 
+    uint32_t i, j; 
+    ChunkState state; 
+} Migration; 
+
+
+typedef struct {
+    Migration* items; 
+    uint32_t n; 
+    uint32_t capacity; 
+} MigrationBuffer; 
+
+
+// Chunk list operations of the membership updates, see particle_set_chunks. 
+typedef struct {
+    uint64_t pops; 
+    uint64_t appends; 
+} MembershipStats; 
+
+
+typedef struct {
+    Chunk*** chunks; 
+    uint32_t chunks_x; 
+    uint32_t chunks_y; 
+    Vec2f chunks_size; 
+    Vec2f dimensions; 
+    Boundary boundary_x;         // left and right side 
+    Boundary boundary_y;         // bottom and top side 
+    uint32_t particles_max_per_chunk; 
+    Particles particles; 
+    uint32_t particles_n; 
+    SpatialIndex spatial_index; 
+    Celllist celllist; 
+    Verlet verlet; 
+    CollideKernel collide_kernel; 
+    PairMode pair_mode; 
+    CollideMode collide_mode; 
+    float cfl;                   // dt is capped to cfl * radius / max speed, 0 = fixed dt 
+    float sweep_margin;          // how far past its radius a particle can get in one tick, cfl * radius while swept 
+    float dt_tick;               // dt of the last tick 
+    double time;                 // simulated time 
+    Engine engine; 
+    Events events; 
+    DtControl dt_control; 
+    Threadpool* threadpool;      // NULL runs physics_tick on the calling thread 
+    MigrationBuffer* migrations; // one per pool thread 
+    uint32_t* id_slot;           // current slot of particle id, slots move on a reorder 
+    uint64_t ticks; 
+    uint32_t reorder_interval;   // Morton reorder every n ticks, 0 = off 
+    float reorder_threshold;     // or when particles_disorder exceeds it, 0 = off 
+    uint32_t reorders; 
+    void* chunks_block;          // chunk grid of chunkmap_regrid, NULL while it lives in the setup_simulation_memory block 
+    uint32_t autotune_ticks;     // ticks timed per candidate grid 
+    float regrid_tolerance;      // re-tune once the density changes by this factor, 0 = off 
+    float regrid_density;        // chunkmap_density when the grid was built 
+    uint32_t regrids; 
+    MembershipStats membership;  // counted since setup, the bench resets it 
+    WallPressure pressure; 
+    Virial virial; 
+} Chunkmap; 
+
+
+float rand_float(float min, float max);
+
+void particle_print(Particles* ps, uint32_t p, const char* prefix);
+void chunkmap_print(Chunkmap* chunkmap, const char* prefix);
+
+bool chunk_ref_is_valid(ChunkRef* chunk_ref);
+uint32_t chunk_append(Chunk* chunk, uint32_t p);
+void chunk_pop(Particles* ps, ChunkRef* chunk_ref);
+
+void collide(Particles* ps, uint32_t p1, uint32_t p2, VirialRow* vr);
+void collide_symmetric(Particles* ps, uint32_t p1, uint32_t p2, VirialRow* vr);
+void collide_swept(Particles* ps, uint32_t p1, uint32_t p2, VirialRow* vr);
+bool collide_kernel_supported(CollideKernel kernel);
+CollideKernel collide_kernel_detect(void);
+uint32_t collide_hits(CollideKernel kernel, Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, uint32_t* hits);
+void collide_list(CollideKernel kernel, Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, VirialRow* vr);
+void collide_list_symmetric(CollideKernel kernel, Particles* ps, uint32_t p, const uint32_t* others, uint32_t n, VirialRow* vr);
+uint64_t collide_kernel_verify(Chunkmap* chunkmap, CollideKernel kernel);
+void particle_collisions(CollideKernel kernel, Particles* ps, uint32_t p, ChunkRef chunk_ref, VirialRow* vr);
+
+size_t particles_memory_size(uint32_t n);
+char* particles_carve(Particles* ps, char* mem, uint32_t n);
+void particles_write_gpu(Chunkmap* chunkmap, Container* container, GPUParticle* gpu_particles);
+// quantize: GPUParticleQ16 of pressure-sim-render.h instead of GPUParticle. 
+uint32_t particles_write_gpu_view(Chunkmap* chunkmap, Container* container, Box view, float particle_radius, bool quantize, void* gpu_particles);
+// LOD snapshot: particle count and mean v^2 per cell of a grid_w x grid_h 
+// grid over view as RGBA8 texels, rows bottom up. bins is scratch of 
+// 2 * grid_w * grid_h floats. Returns how many particles it binned. 
+uint32_t particles_write_density(Chunkmap* chunkmap, Box view, uint32_t grid_w, uint32_t grid_h, float* bins, uint8_t (*texels)[4]);
+
+void chunkmap_init(Chunkmap* chunkmap, Container* container, uint32_t chunks_x, uint32_t chunks_y, uint32_t particles_n, float particle_radius);
+int setup_simulation_memory(void** mem_block_ptr, Chunkmap* chunkmap);
+uint32_t particles_n_max(Container* container, float particle_radius);
+int setup_particles(Chunkmap* chunkmap, float particle_radius, float speed, Container* container);
+void celllist_build(Chunkmap* chunkmap);
+int verlet_build(Chunkmap* chunkmap, float particle_radius);
+size_t verlet_memory_size(Chunkmap* chunkmap);
+void chunkmap_free_verlet(Chunkmap* chunkmap);
+int chunkmap_set_spatial_index(Chunkmap* chunkmap, SpatialIndex spatial_index);
+int chunkmap_set_threadpool(Chunkmap* chunkmap, Threadpool* pool);
+void chunkmap_free_threadpool(Chunkmap* chunkmap);
+float particles_disorder(Chunkmap* chunkmap);
+int particles_reorder_morton(Chunkmap* chunkmap);
+float chunkmap_density(Chunkmap* chunkmap);
+int chunkmap_regrid(Chunkmap* chunkmap, uint32_t chunks_x, uint32_t chunks_y, float particle_radius);
+int chunkmap_set_boundary(Chunkmap* chunkmap, Boundary boundary_x, Boundary boundary_y);
+int chunkmap_set_collide_mode(Chunkmap* chunkmap, CollideMode collide_mode, float cfl, float particle_radius);
+void chunkmap_free_chunks(Chunkmap* chunkmap);
+void chunkmap_teardown(Chunkmap* chunkmap, Threadpool* pool, void* mem_block);
+int chunkmap_autotune(Chunkmap* chunkmap, uint32_t ticks, float dt, float particle_radius, Container* container);
+int chunkmap_set_engine(Chunkmap* chunkmap, Engine engine);
+int dt_control_init(Chunkmap* chunkmap, float dt_min, float overlap_target, const char* log_path);
+int dt_control_set_threads(DtControl* dc, uint32_t threads);
+void dt_control_free(DtControl* dc);
+int physics_tick(float dt, Chunkmap* chunkmap, float particle_radius, Container* container);
+
+int events_advance(Chunkmap* chunkmap, float dt, float particle_radius);
+void events_free(Events* events);
+
+int pressure_init(Chunkmap* chunkmap, uint32_t segments, uint32_t window, uint32_t history);
+int pressure_set_threads(WallPressure* wp, uint32_t threads);
+int pressure_stream_open(WallPressure* wp, const char* path);
+void pressure_tick(Chunkmap* chunkmap, float dt);
+void pressure_stats(WallPressure* wp, PressureStats* stats);
+void pressure_free(WallPressure* wp);
+int virial_init(Chunkmap* chunkmap, uint32_t window);
+int virial_set_threads(Chunkmap* chunkmap, uint32_t threads);
+void virial_tick(Chunkmap* chunkmap, float dt);
+void virial_write(Chunkmap* chunkmap, FILE* out);
+void virial_free(Virial* virial);
+
+
+// the row thread writes to, NULL while the virial is off 
+static inline VirialRow* virial_row(Chunkmap* chunkmap, uint32_t thread) {
+    return chunkmap->virial.enabled ? &chunkmap->virial.rows[thread] : NULL;
+}
+
+
+// Momentum a bounce hands to the wall, counted outwards. along is where on 
+// the wall it hit, 0..1. 
+static inline void wall_impulse(WallPressure* wp, uint32_t thread, Wall wall, float along, float impulse) {
+    uint32_t segment = along <= 0.0f ? 0 : (uint32_t)(along * wp->segments); 
+    if (segment >= wp->segments) segment = wp->segments - 1; 
+    wp->impulse[thread * wp->stride + wall * wp->segments + segment] += impulse; 
+}
+
+
+// sums of the chunk (x, y) is in, clamped to the grid or wrapped around it 
+static inline double* virial_chunk(VirialRow* vr, float x, float y) {
+    int32_t i = (int32_t)(x * vr->inv_chunk_w); 
+    int32_t j = (int32_t)(y * vr->inv_chunk_h); 
+    if (i < 0) i = vr->wrap_x ? (int32_t) vr->chunks_x - 1 : 0; 
+    else if (i >= (int32_t) vr->chunks_x) i = vr->wrap_x ? 0 : (int32_t) vr->chunks_x - 1; 
+    if (j < 0) j = vr->wrap_y ? (int32_t) vr->chunks_y - 1 : 0; 
+    else if (j >= (int32_t) vr->chunks_y) j = vr->wrap_y ? 0 : (int32_t) vr->chunks_y - 1; 
+    return vr->sums + ((size_t) j * vr->chunks_x + i) * VIRIAL_COMPONENTS; 
+}
+
+
+// r12 (x) J at the chunk of (x, y), J the momentum handed to p1 
+static inline void virial_add(VirialRow* vr, float x, float y, float dx, float dy, float jx, float jy) {
+    double* sums = virial_chunk(vr, x, y); 
+    sums[0] += dx * jx; 
+    sums[1] += 0.5f * (dx * jy + dy * jx); 
+    sums[2] += dy * jy; 
+}
+
+#endif
@@ -0,0 +1,383 @@
+// Wall pressure from the bounces in particle_walls and the bulk stress per
+// chunk from the contacts in collide.
+// A bounce off a wall hands it 2*m*|v_n| of momentum, the pressure is that
+// momentum summed over a window of ticks and divided by the window time and
+// the wall length. The bounce only adds to a double in the row of its thread,
+// so the tick functions need no atomics and the rows are folded here, once
+// per tick, by the calling thread. The virial works the same way, with a
+// tensor per chunk instead of a number per wall segment.
+#include "pressure-sim-physics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+#define PRESSURE_COLUMNS (WALL_COUNTER + 1) // the walls and all walls together
+
+
+static size_t pressure_cells(WallPressure* wp) {
+    return (size_t) WALL_COUNTER * wp->segments;
+}
+
+
+int pressure_set_threads(WallPressure* wp, uint32_t threads) {
+    if (threads == 0) threads = 1;
+    size_t stride = align_up(pressure_cells(wp) * sizeof wp->impulse[0], PS_ALIGN) / sizeof wp->impulse[0];
+    size_t size = threads * stride * sizeof wp->impulse[0];
+    double* impulse = aligned_alloc(PS_ALIGN, size);
+    if (impulse == NULL) {
+        fprintf(stderr, "ERROR: malloc of wall pressure rows (size=%zu) failed.\n", size);
+        return -1;
+    }
+    memset(impulse, 0, size);
+    // bounces not yet folded belong to the current window
+    if (wp->impulse != NULL) {
+        for (uint32_t t = 0; t < wp->threads; t++) {
+            for (size_t c = 0; c < pressure_cells(wp); c++) {
+                impulse[c] += wp->impulse[t * wp->stride + c];
+            }
+        }
+    }
+    free(wp->impulse);
+    wp->impulse = impulse;
+    wp->threads = threads;
+    wp->stride = stride;
+    return 0;
+}
+
+
+int pressure_init(Chunkmap* chunkmap, uint32_t segments, uint32_t window, uint32_t history) {
+    WallPressure* wp = &chunkmap->pressure;
+    pressure_free(wp);
+    if (segments == 0) {
+        return 0;
+    }
+    if (window == 0 || history == 0) {
+        fprintf(stderr, "ERROR: wall pressure needs a window and a history of at least 1, got window=%d history=%d\n", window, history);
+        return -1;
+    }
+    wp->segments = segments;
+    wp->window = window;
+    wp->history = history;
+    wp->window_impulse = calloc(pressure_cells(wp), sizeof wp->window_impulse[0]);
+    wp->segment_pressure = calloc(pressure_cells(wp), sizeof wp->segment_pressure[0]);
+    wp->history_pressure = calloc((size_t) history * PRESSURE_COLUMNS, sizeof wp->history_pressure[0]);
+    if (wp->window_impulse == NULL || wp->segment_pressure == NULL || wp->history_pressure == NULL) {
+        fprintf(stderr, "ERROR: malloc of wall pressure (segments=%d, history=%d) failed.\n", segments, history);
+        pressure_free(wp);
+        return -1;
+    }
+    if (pressure_set_threads(wp, chunkmap->threadpool != NULL ? chunkmap->threadpool->threads : 1) < 0) {
+        pressure_free(wp);
+        return -1;
+    }
+    return 0;
+}
+
+
+// path ending in .csv writes text, anything else packed binary records of
+// uint64 tick, double time, float[WALL_COUNTER + 1] wall pressure,
+// float[WALL_COUNTER * segments] segment pressure
+int pressure_stream_open(WallPressure* wp, const char* path) {
+    if (wp->stream != NULL) {
+        fclose(wp->stream);
+        wp->stream = NULL;
+    }
+    size_t len = strlen(path);
+    bool csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+    FILE* stream = fopen(path, csv ? "w" : "wb");
+    if (stream == NULL) {
+        fprintf(stderr, "ERROR: could not open wall pressure stream %s\n", path);
+        return -1;
+    }
+    if (csv) {
+        fprintf(stream, "tick,time");
+        for (Wall w = 0; w < WALL_COUNTER; w++) {
+            fprintf(stream, ",%s", wall_to_name(w));
+        }
+        fprintf(stream, ",total");
+        for (Wall w = 0; w < WALL_COUNTER; w++) {
+            for (uint32_t s = 0; s < wp->segments; s++) {
+                fprintf(stream, ",%s_%d", wall_to_name(w), s);
+            }
+        }
+        fprintf(stream, "\n");
+    }
+    wp->stream = stream;
+    wp->stream_binary = !csv;
+    return 0;
+}
+
+
+static void pressure_write(WallPressure* wp, uint64_t tick, const float* walls) {
+    if (wp->stream_binary) {
+        fwrite(&tick, sizeof tick, 1, wp->stream);
+        fwrite(&wp->time, sizeof wp->time, 1, wp->stream);
+        fwrite(walls, sizeof walls[0], PRESSURE_COLUMNS, wp->stream);
+        fwrite(wp->segment_pressure, sizeof wp->segment_pressure[0], pressure_cells(wp), wp->stream);
+        return;
+    }
+    fprintf(wp->stream, "%llu,%g", (unsigned long long) tick, wp->time);
+    for (uint32_t c = 0; c < PRESSURE_COLUMNS; c++) {
+        fprintf(wp->stream, ",%g", walls[c]);
+    }
+    for (size_t c = 0; c < pressure_cells(wp); c++) {
+        fprintf(wp->stream, ",%g", wp->segment_pressure[c]);
+    }
+    fprintf(wp->stream, "\n");
+}
+
+
+// Turns the window into a sample: pressure per segment and wall, pushed into
+// the history ring and the stream. The sides of a periodic axis are no walls,
+// they read 0 and are left out of the total.
+static void pressure_sample(Chunkmap* chunkmap) {
+    WallPressure* wp = &chunkmap->pressure;
+    float lengths[WALL_COUNTER];
+    lengths[WALL_LEFT] = lengths[WALL_RIGHT] = chunkmap->dimensions.y;
+    lengths[WALL_BOTTOM] = lengths[WALL_TOP] = chunkmap->dimensions.x;
+    float* walls = wp->history_pressure + (size_t) wp->history_head * PRESSURE_COLUMNS;
+    double total = 0.0;
+    double perimeter = 0.0;
+    for (Wall w = 0; w < WALL_COUNTER; w++) {
+        double wall = 0.0;
+        for (uint32_t s = 0; s < wp->segments; s++) {
+            size_t c = w * wp->segments + s;
+            wp->segment_pressure[c] = wp->window_impulse[c] / (wp->window_time * lengths[w] / wp->segments);
+            wall += wp->window_impulse[c];
+            wp->window_impulse[c] = 0.0;
+        }
+        walls[w] = wall / (wp->window_time * lengths[w]);
+        Boundary boundary = w == WALL_LEFT || w == WALL_RIGHT ? chunkmap->boundary_x : chunkmap->boundary_y;
+        if (boundary == BOUNDARY_WALLS) {
+            total += wall;
+            perimeter += lengths[w];
+        }
+    }
+    walls[WALL_COUNTER] = perimeter > 0.0 ? total / (wp->window_time * perimeter) : 0.0f;
+    if (wp->stream != NULL) {
+        pressure_write(wp, chunkmap->ticks, walls);
+    }
+    wp->history_head = (wp->history_head + 1) % wp->history;
+    if (wp->history_n < wp->history) wp->history_n++;
+    wp->samples++;
+    wp->window_ticks = 0;
+    wp->window_time = 0.0;
+}
+
+
+// Folds the rows of the tick that just ran into the window, called by
+// physics_tick after the particles moved.
+void pressure_tick(Chunkmap* chunkmap, float dt) {
+    WallPressure* wp = &chunkmap->pressure;
+    size_t cells = pressure_cells(wp);
+    for (uint32_t t = 0; t < wp->threads; t++) {
+        double* row = wp->impulse + t * wp->stride;
+        for (size_t c = 0; c < cells; c++) {
+            wp->window_impulse[c] += row[c];
+        }
+        memset(row, 0, cells * sizeof row[0]);
+    }
+    wp->window_ticks++;
+    wp->window_time += dt;
+    wp->time += dt;
+    if (wp->window_ticks >= wp->window) {
+        pressure_sample(chunkmap);
+    }
+}
+
+
+void pressure_stats(WallPressure* wp, PressureStats* stats) {
+    memset(stats, 0, sizeof *stats);
+    stats->samples = wp->history_n;
+    if (wp->history_n == 0) {
+        return;
+    }
+    uint32_t last = (wp->history_head + wp->history - 1) % wp->history;
+    for (uint32_t c = 0; c < PRESSURE_COLUMNS; c++) {
+        stats->last[c] = wp->history_pressure[(size_t) last * PRESSURE_COLUMNS + c];
+        double sum = 0.0, sum2 = 0.0;
+        // the ring is full or filled from 0, either way the first history_n rows
+        for (uint32_t h = 0; h < wp->history_n; h++) {
+            double v = wp->history_pressure[(size_t) h * PRESSURE_COLUMNS + c];
+            sum += v;
+            sum2 += v * v;
+        }
+        double mean = sum / wp->history_n;
+        stats->mean[c] = mean;
+        stats->variance[c] = fmax(sum2 / wp->history_n - mean * mean, 0.0);
+    }
+}
+
+
+void pressure_free(WallPressure* wp) {
+    free(wp->impulse);
+    free(wp->window_impulse);
+    free(wp->segment_pressure);
+    free(wp->history_pressure);
+    if (wp->stream != NULL) {
+        fclose(wp->stream);
+    }
+    memset(wp, 0, sizeof *wp);
+}
+
+
+static size_t virial_cells(Virial* virial) {
+    return (size_t) virial->chunks_x * virial->chunks_y * VIRIAL_COMPONENTS;
+}
+
+
+static void virial_free_arrays(Virial* virial) {
+    free(virial->rows_block);
+    free(virial->rows);
+    free(virial->window_sums);
+    free(virial->stress);
+    free(virial->stress_sum);
+    virial->rows_block = NULL;
+    virial->rows = NULL;
+    virial->window_sums = NULL;
+    virial->stress = NULL;
+    virial->stress_sum = NULL;
+}
+
+
+// Sizes everything to the current chunk grid and thread count. The window
+// and the samples so far are dropped, their chunks may not exist anymore.
+int virial_set_threads(Chunkmap* chunkmap, uint32_t threads) {
+    Virial* virial = &chunkmap->virial;
+    if (threads == 0) threads = 1;
+    virial_free_arrays(virial);
+    virial->threads = threads;
+    virial->chunks_x = chunkmap->chunks_x;
+    virial->chunks_y = chunkmap->chunks_y;
+    virial->stride = align_up(virial_cells(virial) * sizeof virial->rows_block[0], PS_ALIGN) / sizeof virial->rows_block[0];
+    size_t size = threads * virial->stride * sizeof virial->rows_block[0];
+    virial->rows_block = aligned_alloc(PS_ALIGN, size);
+    virial->rows = calloc(threads, sizeof virial->rows[0]);
+    virial->window_sums = calloc(virial_cells(virial), sizeof virial->window_sums[0]);
+    virial->stress = calloc(virial_cells(virial), sizeof virial->stress[0]);
+    virial->stress_sum = calloc(virial_cells(virial), sizeof virial->stress_sum[0]);
+    if (virial->rows_block == NULL || virial->rows == NULL || virial->window_sums == NULL || virial->stress == NULL || virial->stress_sum == NULL) {
+        fprintf(stderr, "ERROR: malloc of virial rows (size=%zu, chunks=%dx%d) failed.\n", size, virial->chunks_x, virial->chunks_y);
+        virial_free_arrays(virial);
+        virial->enabled = false;
+        return -1;
+    }
+    memset(virial->rows_block, 0, size);
+    for (uint32_t t = 0; t < threads; t++) {
+        virial->rows[t] = (VirialRow) {
+            .sums = virial->rows_block + t * virial->stride,
+            .chunks_x = virial->chunks_x,
+            .chunks_y = virial->chunks_y,
+            .inv_chunk_w = 1.0f / chunkmap->chunks_size.x,
+            .inv_chunk_h = 1.0f / chunkmap->chunks_size.y,
+            .wrap_x = chunkmap->boundary_x == BOUNDARY_PERIODIC,
+            .wrap_y = chunkmap->boundary_y == BOUNDARY_PERIODIC
+        };
+    }
+    virial->window_ticks = 0;
+    virial->window_time = 0.0;
+    virial->pressure = 0.0f;
+    virial->pressure_sum = 0.0;
+    virial->samples = 0;
+    return 0;
+}
+
+
+int virial_init(Chunkmap* chunkmap, uint32_t window) {
+    Virial* virial = &chunkmap->virial;
+    virial_free(virial);
+    if (window == 0) {
+        return 0;
+    }
+    virial->window = window;
+    virial->enabled = true;
+    return virial_set_threads(chunkmap, chunkmap->threadpool != NULL ? chunkmap->threadpool->threads : 1);
+}
+
+
+// Turns the window into a sample, the kinetic part comes from the particles
+// as they are now.
+static void virial_sample(Chunkmap* chunkmap) {
+    Virial* virial = &chunkmap->virial;
+    Particles* ps = &chunkmap->particles;
+    size_t cells = virial_cells(virial);
+    double* sums = virial->window_sums;
+    for (size_t c = 0; c < cells; c++) {
+        sums[c] /= virial->window_time;
+    }
+    // the row of thread 0 was just zeroed by the fold, it serves as the view of the grid
+    VirialRow view = virial->rows[0];
+    view.sums = sums;
+    for (uint32_t p = 0; p < chunkmap->particles_n; p++) {
+        double* s = virial_chunk(&view, ps->x[p], ps->y[p]);
+        s[0] += ps->mass[p] * ps->vx[p] * ps->vx[p];
+        s[1] += ps->mass[p] * ps->vx[p] * ps->vy[p];
+        s[2] += ps->mass[p] * ps->vy[p] * ps->vy[p];
+    }
+    double inv_area = 1.0 / ((double) chunkmap->chunks_size.x * chunkmap->chunks_size.y);
+    double pressure = 0.0;
+    for (size_t c = 0; c < cells; c++) {
+        virial->stress[c] = sums[c] * inv_area;
+        virial->stress_sum[c] += virial->stress[c];
+        sums[c] = 0.0;
+    }
+    for (size_t c = 0; c < cells; c += VIRIAL_COMPONENTS) {
+        pressure += 0.5 * (virial->stress[c] + virial->stress[c + 2]);
+    }
+    // the chunks have equal areas, the container pressure is their mean
+    virial->pressure = pressure / (virial->chunks_x * virial->chunks_y);
+    virial->pressure_sum += virial->pressure;
+    virial->samples++;
+    virial->window_ticks = 0;
+    virial->window_time = 0.0;
+}
+
+
+// Reduces the thread rows of the tick that just ran, called by physics_tick.
+void virial_tick(Chunkmap* chunkmap, float dt) {
+    Virial* virial = &chunkmap->virial;
+    if (virial->chunks_x != chunkmap->chunks_x || virial->chunks_y != chunkmap->chunks_y) {
+        // regridded, the rows of this tick used the old grid
+        virial_set_threads(chunkmap, virial->threads);
+        return;
+    }
+    size_t cells = virial_cells(virial);
+    for (uint32_t t = 0; t < virial->threads; t++) {
+        double* row = virial->rows[t].sums;
+        for (size_t c = 0; c < cells; c++) {
+            virial->window_sums[c] += row[c];
+        }
+        memset(row, 0, cells * sizeof row[0]);
+    }
+    virial->window_ticks++;
+    virial->window_time += dt;
+    if (virial->window_ticks >= virial->window) {
+        virial_sample(chunkmap);
+    }
+}
+
+
+// The stress field averaged over the samples as CSV, one line per chunk with
+// its center.
+void virial_write(Chunkmap* chunkmap, FILE* out) {
+    Virial* virial = &chunkmap->virial;
+    fprintf(out, "i,j,x,y,pressure,sxx,sxy,syy\n");
+    if (virial->samples == 0) {
+        return;
+    }
+    for (uint32_t j = 0; j < virial->chunks_y; j++) {
+        for (uint32_t i = 0; i < virial->chunks_x; i++) {
+            double* s = virial->stress_sum + ((size_t) j * virial->chunks_x + i) * VIRIAL_COMPONENTS;
+            double sxx = s[0] / virial->samples, sxy = s[1] / virial->samples, syy = s[2] / virial->samples;
+            fprintf(out, "%d,%d,%g,%g,%g,%g,%g,%g\n", i, j, (i + 0.5f) * chunkmap->chunks_size.x, (j + 0.5f) * chunkmap->chunks_size.y,
+                0.5 * (sxx + syy), sxx, sxy, syy);
+        }
+    }
+}
+
+
+void virial_free(Virial* virial) {
+    virial_free_arrays(virial);
+    memset(virial, 0, sizeof *virial);
+}
@@ -0,0 +1,33 @@
+#ifndef PS_RENDER_H_
+#define PS_RENDER_H_
+
+#include <stdint.h>
+
+// Render side types. Of the physics only the snapshot writers see them,
+// they fill GPUParticleQ16.
+
+
+// quantize=1: container coords as 16 bit unorm, a quarter of the padded
+// GPUParticle. CircleQ16.vert.hlsl decodes them with GPUParticleTransform.
+typedef struct {
+    uint16_t x, y;
+} GPUParticleQ16;
+
+
+// Pan and zoom of the render: gpu' = (gpu - (x, y)) * zoom.
+typedef struct {
+    float x, y;     // gpu coords in the middle of the window
+    float zoom;     // 1 shows the whole container
+} Camera;
+
+
+// Vertex uniform of Circle.vert.hlsl and CircleQ16.vert.hlsl, the camera
+// folded into the decode: gpu' = position * scale + offset + vertex * quad_scale.
+typedef struct {
+    float scale_x, scale_y;
+    float offset_x, offset_y;
+    float quad_scale;
+    float _pad[3];
+} GPUParticleTransform;
+
+#endif
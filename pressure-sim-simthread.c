@@ -0,0 +1,427 @@
+// The simulation on its own thread. physics_tick runs here, paced against
+// the wall clock, and every batch of ticks is published as a snapshot that
+// the render thread picks up without blocking, so a slow frame no longer
+// stalls the physics and the upload no longer waits for the ticks.
+#include "pressure-sim-simthread.h"
+#include "pressure-sim-render.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <time.h>
+
+#define SNAPSHOT_FRESH 4u
+#define SIM_IDLE_NS 500000 // nothing to do: paused, or the next realtime tick is not due yet
+
+
+uint64_t sim_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void sim_sleep_ns(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull };
+    nanosleep(&ts, NULL);
+}
+
+
+static void triple_buffer_free(TripleBuffer* tb) {
+    for (uint32_t s = 0; s < 3; s++) {
+        if (!tb->mapped) {
+            free(tb->slots[s].particles);
+        }
+        tb->slots[s].particles = NULL;
+    }
+}
+
+
+static int triple_buffer_init(TripleBuffer* tb, uint32_t particles_n, uint32_t particle_size, void* mapped[2]) {
+    tb->mapped = mapped != NULL;
+    for (uint32_t s = 0; s < 3; s++) {
+        tb->slots[s] = (Snapshot) { .slot = s };
+        if (tb->mapped) {
+            tb->slots[s].particles = s < 2 ? mapped[s] : NULL;
+            continue;
+        }
+        tb->slots[s].particles = calloc(particles_n, particle_size);
+        if (tb->slots[s].particles == NULL) {
+            fprintf(stderr, "ERROR: malloc of snapshot %d (%d particles) failed.\n", s, particles_n);
+            triple_buffer_free(tb);
+            return -1;
+        }
+    }
+    tb->back = 0;
+    atomic_init(&tb->middle, 1);
+    tb->front = 2;
+    return 0;
+}
+
+
+// Producer: the back slot becomes the latest snapshot, the old middle one
+// is the next back slot.
+static void triple_buffer_publish(TripleBuffer* tb) {
+    tb->back = atomic_exchange_explicit(&tb->middle, tb->back | SNAPSHOT_FRESH, memory_order_acq_rel) & ~SNAPSHOT_FRESH;
+}
+
+
+// Only the producer sets the fresh bit, so a fresh middle slot stays fresh
+// until the consumer takes it.
+static bool triple_buffer_fresh(TripleBuffer* tb) {
+    return (atomic_load_explicit(&tb->middle, memory_order_acquire) & SNAPSHOT_FRESH) != 0;
+}
+
+
+uint32_t sim_thread_particle_size(const Config* config) {
+    return config->quantize ? sizeof(GPUParticleQ16) : sizeof(GPUParticle);
+}
+
+
+void sim_thread_grid_size(const Config* config, uint32_t* grid_w, uint32_t* grid_h) {
+    *grid_w = (config->width + config->lod_tile - 1) / config->lod_tile;
+    *grid_h = (config->height + config->lod_tile - 1) / config->lod_tile;
+}
+
+
+bool sim_thread_fresh(SimThread* sim) {
+    return triple_buffer_fresh(&sim->snapshots);
+}
+
+
+// The fresh bit is tested once here: with mapped slots the caller only
+// mapped the front slot again if sim_thread_fresh said so, and a fresh
+// middle slot stays fresh until this swap takes it.
+const Snapshot* sim_thread_snapshot(SimThread* sim, void* remapped, bool* fresh) {
+    TripleBuffer* tb = &sim->snapshots;
+    *fresh = tb->mapped ? remapped != NULL : triple_buffer_fresh(tb);
+    if (*fresh) {
+        if (tb->mapped) {
+            tb->slots[tb->front].particles = remapped;
+        }
+        tb->front = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel) & ~SNAPSHOT_FRESH;
+    }
+    return &tb->slots[tb->front];
+}
+
+
+// Past lod_threshold particles per pixel the quads are smaller than the
+// pixels they land on, a density grid shows the same at O(pixels). The
+// particles in view are estimated from the share of the container it covers.
+static bool sim_lod(SimThread* sim) {
+    if (sim->lod_bins == NULL || !sim->view_set) {
+        return false;
+    }
+    Container* container = sim->container;
+    Box view = sim->view;
+    float w = new_min(view.r, (float) container->width) - new_max(view.l, 0.0f);
+    float h = new_min(view.t, (float) container->height) - new_max(view.b, 0.0f);
+    if (!(w > 0.0f && h > 0.0f)) {
+        return false;
+    }
+    float visible = sim->chunkmap->particles_n * (w * h) / ((float) container->width * container->height);
+    return visible >= sim->lod_threshold * sim->pixels;
+}
+
+
+static void sim_publish(SimThread* sim) {
+    uint64_t start = sim_now_ns();
+    Chunkmap* chunkmap = sim->chunkmap;
+    Snapshot* snapshot = &sim->snapshots.slots[sim->snapshots.back];
+    snapshot->lod = sim_lod(sim);
+    if (snapshot->lod) {
+        snapshot->instances = particles_write_density(chunkmap, sim->view, sim->grid_w, sim->grid_h, sim->lod_bins, snapshot->particles);
+        atomic_fetch_add_explicit(&sim->stats.lod_publishes, 1, memory_order_relaxed);
+    } else {
+        snapshot->instances = particles_write_gpu_view(chunkmap, sim->container, sim->view, sim->particle_radius, sim->quantize, snapshot->particles);
+    }
+    snapshot->grid_w = sim->grid_w;
+    snapshot->grid_h = sim->grid_h;
+    snapshot->particles_n = chunkmap->particles_n;
+    snapshot->chunks_x = chunkmap->chunks_x;
+    snapshot->chunks_y = chunkmap->chunks_y;
+    snapshot->ticks = chunkmap->ticks;
+    snapshot->time = chunkmap->time;
+    triple_buffer_publish(&sim->snapshots);
+    atomic_fetch_add_explicit(&sim->stats.publishes, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sim->stats.publish_ns, sim_now_ns() - start, memory_order_relaxed);
+}
+
+
+static int sim_tick(SimThread* sim) {
+    uint64_t start = sim_now_ns();
+    int result = physics_tick(sim->dt, sim->chunkmap, sim->particle_radius, sim->container);
+    atomic_fetch_add_explicit(&sim->stats.ticks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sim->stats.tick_ns, sim_now_ns() - start, memory_order_relaxed);
+    return result;
+}
+
+
+static int sim_command_push(SimThread* sim, SimCommand command) {
+    uint32_t head = atomic_load_explicit(&sim->command_head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&sim->command_tail, memory_order_acquire);
+    if (head - tail == SIM_COMMANDS) {
+        fprintf(stderr, "ERROR: physics thread command queue full.\n");
+        return -1;
+    }
+    sim->commands[head % SIM_COMMANDS] = command;
+    atomic_store_explicit(&sim->command_head, head + 1, memory_order_release);
+    return 0;
+}
+
+
+int sim_thread_command(SimThread* sim, SimCommandType type, float value) {
+    return sim_command_push(sim, (SimCommand) { .type = type, .value = value });
+}
+
+
+int sim_thread_view(SimThread* sim, Box view) {
+    return sim_command_push(sim, (SimCommand) { .type = SIM_CMD_VIEW, .view = view });
+}
+
+
+static void sim_command_run(SimThread* sim, SimCommand command) {
+    Chunkmap* chunkmap = sim->chunkmap;
+    switch (command.type) {
+    case SIM_CMD_PAUSE: {
+        switch (sim->state) {
+            case SIM_RUNNING: {
+                sim->state = SIM_PAUSED;
+                printf("Simulation: paused!\n");
+            } break;
+            case SIM_PAUSED: {
+                sim->state = SIM_RUNNING;
+                sim->pacer.last_ns = sim_now_ns(); // no time owed for the pause
+                printf("Simulation: running!\n");
+            } break;
+            default: {} break;
+        }
+    } break;
+    case SIM_CMD_STEP: {
+        sim->steps++;
+    } break;
+    case SIM_CMD_DT: {
+        // never at or below zero, and with the adaptive dt never below its floor
+        float dt_floor = sim->chunkmap->dt_control.enabled ? new_max(sim->dt_step, sim->chunkmap->dt_control.dt_min) : sim->dt_step;
+        sim->dt = new_max(sim->dt + command.value * sim->dt_step, dt_floor);
+        printf("dt=%f\n", sim->dt);
+    } break;
+    case SIM_CMD_PACE: {
+        sim->pacer.mode = (sim->pacer.mode + 1) % PACE_COUNTER;
+        sim->pacer.accumulator = 0.0;
+        printf("pace=%s\n", pace_mode_to_name(sim->pacer.mode));
+    } break;
+    case SIM_CMD_TIME_SCALE: {
+        sim->pacer.time_scale *= command.value;
+        printf("time_scale=%g\n", sim->pacer.time_scale);
+    } break;
+    case SIM_CMD_PAIRS: {
+        if (chunkmap->collide_mode == COLLIDE_MODE_SWEPT) {
+            printf("swept collisions need pair mode symmetric\n");
+            break;
+        }
+        chunkmap->pair_mode = (chunkmap->pair_mode + 1) % PAIRS_COUNTER;
+        printf("pair mode=%s\n", pair_mode_to_name(chunkmap->pair_mode));
+    } break;
+    case SIM_CMD_ENGINE: {
+        Engine next = (chunkmap->engine + 1) % ENGINE_COUNTER;
+        if (chunkmap_set_engine(chunkmap, next) == 0) {
+            printf("engine=%s\n", engine_to_name(next));
+        }
+    } break;
+    case SIM_CMD_INDEX: {
+        SpatialIndex next = (chunkmap->spatial_index + 1) % SPATIAL_COUNTER;
+        if (chunkmap_set_spatial_index(chunkmap, next) == 0) {
+            printf("spatial index=%s\n", spatial_index_to_name(next));
+        }
+    } break;
+    case SIM_CMD_VIEW: {
+        sim->view = command.view;
+        sim->view_set = true;
+        sim->republish = true;
+    } break;
+    default: {
+        fprintf(stderr, "invalid sim command\n");
+    } break;
+    }
+}
+
+
+static void sim_commands(SimThread* sim) {
+    uint32_t tail = atomic_load_explicit(&sim->command_tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&sim->command_head, memory_order_acquire);
+    for (; tail != head; tail++) {
+        sim_command_run(sim, sim->commands[tail % SIM_COMMANDS]);
+    }
+    atomic_store_explicit(&sim->command_tail, tail, memory_order_release);
+}
+
+
+// One batch of ticks while running, *ticked says whether there was one.
+static int sim_pace(SimThread* sim, bool* ticked) {
+    Pacer* pacer = &sim->pacer;
+    uint64_t start = sim_now_ns();
+    double wall_s = (start - pacer->last_ns) * 1e-9;
+    pacer->last_ns = start;
+    switch (pacer->mode) {
+    case PACE_FRAME: {
+        // one tick per presented frame: wait until the render took the last one
+        if (triple_buffer_fresh(&sim->snapshots)) {
+            return 0;
+        }
+        *ticked = true;
+        return sim_tick(sim);
+    } break;
+    case PACE_REALTIME: {
+        pacer->accumulator += wall_s * pacer->time_scale;
+        while (pacer->accumulator >= sim->dt) {
+            // the ticks can't keep up, drop the backlog instead of growing it
+            // batch after batch
+            if (sim_now_ns() - start >= pacer->budget_ns) {
+                pacer->accumulator = 0.0;
+                atomic_fetch_add_explicit(&sim->stats.behind, 1, memory_order_relaxed);
+                break;
+            }
+            if (sim_tick(sim) < 0) {
+                return -1;
+            }
+            *ticked = true;
+            pacer->accumulator -= sim->chunkmap->dt_tick; // shorter than dt with cfl or the dt controller
+        }
+    } break;
+    case PACE_FAST: {
+        do {
+            if (sim_tick(sim) < 0) {
+                return -1;
+            }
+        } while (sim_now_ns() - start < pacer->budget_ns);
+        *ticked = true;
+    } break;
+    default: {
+        fprintf(stderr, "Pace mode invalid.\n");
+    } break;
+    }
+    return 0;
+}
+
+
+static void* sim_thread_main(void* arg) {
+    SimThread* sim = arg;
+    sim->pacer.last_ns = sim_now_ns();
+    while (!atomic_load_explicit(&sim->quit, memory_order_acquire)) {
+        sim_commands(sim);
+        bool ticked = false;
+        int result = 0;
+        switch (sim->state) {
+            case SIM_RUNNING: {
+                result = sim_pace(sim, &ticked);
+            } break;
+            case SIM_PAUSED: {
+                while (sim->steps > 0 && result == 0) {
+                    printf("Stepping 1\n");
+                    result = sim_tick(sim);
+                    ticked = true;
+                    sim->steps--;
+                }
+            } break;
+            case SIM_STOPPED: {
+
+            } break;
+            default: {
+                fprintf(stderr, "Sim state invalid.\n");
+            } break;
+        }
+        if (result < 0) {
+            fprintf(stderr, "ERROR: physics_tick, stopping simulation.\n");
+            sim->state = SIM_STOPPED;
+            sim->steps = 0;
+        }
+        if (ticked || sim->republish) {
+            sim->republish = false;
+            sim_publish(sim);
+        } else {
+            sim_sleep_ns(SIM_IDLE_NS);
+        }
+    }
+    return NULL;
+}
+
+
+// Starts paused, like the single threaded loop did.
+int sim_thread_start(SimThread* sim, Chunkmap* chunkmap, Container* container, float particle_radius, const Config* config, void* mapped[2]) {
+    *sim = (SimThread) {
+        .chunkmap = chunkmap,
+        .container = container,
+        .particle_radius = particle_radius,
+        .dt = config->dt,
+        .dt_step = 0.1f * config->dt,
+        .quantize = config->quantize != 0,
+        .view = { -FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX }, // everything until the render sends its view
+        .lod_threshold = config->lod_threshold,
+        .pixels = (float) config->width * config->height,
+        .state = SIM_PAUSED,
+        .pacer = {
+            .mode = config->pace,
+            .time_scale = config->time_scale,
+            .budget_ns = (uint64_t) (config->frame_budget * 1e6)
+        }
+    };
+    atomic_init(&sim->command_head, 0);
+    atomic_init(&sim->command_tail, 0);
+    atomic_init(&sim->quit, false);
+    sim->stats.start_ns = sim_now_ns();
+    // the texels go into the snapshot slots, a run with fewer particle
+    // bytes than grid cells never gets dense enough to need them
+    sim_thread_grid_size(config, &sim->grid_w, &sim->grid_h);
+    uint32_t cells = sim->grid_w * sim->grid_h;
+    if (config->lod_threshold > 0.0f && (uint64_t) cells * 4 <= (uint64_t) chunkmap->particles_n * sim_thread_particle_size(config)) {
+        sim->lod_bins = malloc(2 * (size_t) cells * sizeof sim->lod_bins[0]);
+        if (sim->lod_bins == NULL) {
+            fprintf(stderr, "ERROR: malloc of the density grid (%d cells) failed.\n", cells);
+            return -1;
+        }
+    }
+    if (triple_buffer_init(&sim->snapshots, chunkmap->particles_n, sim_thread_particle_size(config), mapped) < 0) {
+        free(sim->lod_bins);
+        return -1;
+    }
+    sim_publish(sim); // the render has a state before the first tick
+    if (pthread_create(&sim->thread, NULL, sim_thread_main, sim) != 0) {
+        fprintf(stderr, "ERROR: pthread_create of the physics thread failed.\n");
+        triple_buffer_free(&sim->snapshots);
+        free(sim->lod_bins);
+        return -1;
+    }
+    return 0;
+}
+
+
+void sim_thread_stop(SimThread* sim) {
+    atomic_store_explicit(&sim->quit, true, memory_order_release);
+    pthread_join(sim->thread, NULL);
+    triple_buffer_free(&sim->snapshots);
+    free(sim->lod_bins);
+    sim->lod_bins = NULL;
+}
+
+
+void sim_stats_print(SimThread* sim, FILE* out) {
+    SimStats* stats = &sim->stats;
+    double wall_s = (sim_now_ns() - stats->start_ns) * 1e-9;
+    uint64_t ticks = atomic_load_explicit(&stats->ticks, memory_order_relaxed);
+    uint64_t tick_ns = atomic_load_explicit(&stats->tick_ns, memory_order_relaxed);
+    uint64_t publishes = atomic_load_explicit(&stats->publishes, memory_order_relaxed);
+    uint64_t publish_ns = atomic_load_explicit(&stats->publish_ns, memory_order_relaxed);
+    uint64_t behind = atomic_load_explicit(&stats->behind, memory_order_relaxed);
+    uint64_t lod_publishes = atomic_load_explicit(&stats->lod_publishes, memory_order_relaxed);
+    uint64_t frames = atomic_load_explicit(&stats->frames, memory_order_relaxed);
+    uint64_t frames_fresh = atomic_load_explicit(&stats->frames_fresh, memory_order_relaxed);
+    uint64_t upload_ns = atomic_load_explicit(&stats->upload_ns, memory_order_relaxed);
+    uint64_t frame_ns = atomic_load_explicit(&stats->frame_ns, memory_order_relaxed);
+    fprintf(out, "physics thread: %lu ticks (%.1f/s, %.3f ms each, %.0f%% busy), %lu snapshots (%.3f ms each, %lu density grids), behind real time %lu times\n",
+        (unsigned long) ticks, ticks / wall_s, ticks > 0 ? tick_ns * 1e-6 / ticks : 0.0, 100.0 * (tick_ns + publish_ns) * 1e-9 / wall_s,
+        (unsigned long) publishes, publishes > 0 ? publish_ns * 1e-6 / publishes : 0.0, (unsigned long) lod_publishes, (unsigned long) behind);
+    fprintf(out, "render thread: %lu frames (%.1f/s, %.3f ms each), %lu with a new snapshot, %.3f ms upload per frame, %.1f ticks per frame\n",
+        (unsigned long) frames, frames / wall_s, frames > 0 ? frame_ns * 1e-6 / frames : 0.0, (unsigned long) frames_fresh,
+        frames > 0 ? upload_ns * 1e-6 / frames : 0.0, frames > 0 ? (double) ticks / frames : 0.0);
+}
@@ -0,0 +1,156 @@
+#ifndef PS_SIMTHREAD_H_
+#define PS_SIMTHREAD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "pressure-sim-config.h"
+
+
+typedef enum {
+    SIM_INVALID,
+    SIM_RUNNING,
+    SIM_STOPPED,
+    SIM_PAUSED,
+    SIM_COUNTER
+} SimState;
+
+
+// The state the render needs from one point in simulated time.
+typedef struct {
+    void* particles;            // [id], GPUParticle or GPUParticleQ16, see SimThread.quantize
+    uint32_t slot;              // in TripleBuffer.slots
+    uint32_t particles_n;
+    uint32_t instances;         // particles written, the visible ones while the view is culled
+    bool lod;                   // particles holds grid_w x grid_h RGBA8 texels instead, see particles_write_density
+    uint32_t grid_w;
+    uint32_t grid_h;
+    uint32_t chunks_x;          // the debug grid, it changes on a regrid
+    uint32_t chunks_y;
+    uint64_t ticks;
+    double time;
+} Snapshot;
+
+
+// Lock-free triple buffer between the physics thread (producer) and the
+// render thread (consumer). The producer fills its back slot and swaps it
+// with the middle one, the consumer swaps the middle slot with its front
+// slot whenever a new one was published. Neither side ever waits, a
+// snapshot the render did not get to in time is overwritten. With mapped
+// slots the particles live in upload buffers the render thread maps: the
+// producer's two slots stay mapped, the front slot is unmapped while its
+// upload is in flight and mapped again before the swap hands it back.
+typedef struct {
+    Snapshot slots[3];
+    atomic_uint middle;         // slot index | SNAPSHOT_FRESH
+    uint32_t back;              // producer only
+    uint32_t front;             // consumer only
+    bool mapped;                // particles point into render owned memory, see sim_thread_start
+} TripleBuffer;
+
+
+// Fixed step accumulator between the wall clock and physics_tick.
+typedef struct {
+    PaceMode mode;
+    float time_scale;           // simulated seconds per wall clock second, PACE_REALTIME
+    uint64_t budget_ns;         // ticks between two snapshots take this long at most
+    double accumulator;         // simulated time owed to the wall clock, PACE_REALTIME
+    uint64_t last_ns;           // wall clock of the previous batch
+} Pacer;
+
+
+// Render thread -> physics thread, everything that touches the chunkmap
+// while the physics thread runs goes through these.
+typedef enum {
+    SIM_CMD_PAUSE,              // toggles running and paused
+    SIM_CMD_STEP,               // one tick while paused
+    SIM_CMD_DT,                 // dt += value
+    SIM_CMD_PACE,               // next pace mode
+    SIM_CMD_TIME_SCALE,         // time_scale *= value
+    SIM_CMD_PAIRS,              // next pair mode
+    SIM_CMD_ENGINE,             // next engine
+    SIM_CMD_INDEX,              // next spatial index
+    SIM_CMD_VIEW,               // snapshots only hold the particles in view
+    SIM_CMD_COUNTER
+} SimCommandType;
+
+typedef struct {
+    SimCommandType type;
+    float value;
+    Box view;                   // SIM_CMD_VIEW, container units
+} SimCommand;
+
+#define SIM_COMMANDS 64 // single producer single consumer ring
+
+
+// Timings of both threads. Every counter is written by one thread only and
+// read by any.
+typedef struct {
+    _Atomic uint64_t ticks;
+    _Atomic uint64_t tick_ns;       // inside physics_tick
+    _Atomic uint64_t publishes;
+    _Atomic uint64_t publish_ns;    // writing snapshots
+    _Atomic uint64_t lod_publishes; // snapshots that were density grids
+    _Atomic uint64_t behind;        // batches that ran out of budget and dropped the rest of the accumulator
+    _Atomic uint64_t frames;
+    _Atomic uint64_t frames_fresh;  // frames that got a new snapshot
+    _Atomic uint64_t upload_ns;     // taking the snapshot and copying it into the transfer buffer
+    _Atomic uint64_t frame_ns;      // whole frames, vsync included
+    uint64_t start_ns;
+} SimStats;
+
+
+typedef struct {
+    pthread_t thread;
+    Chunkmap* chunkmap;         // owned by the physics thread between start and stop
+    Container* container;
+    float particle_radius;
+    float dt;
+    float dt_step;              // SIM_CMD_DT steps, a tenth of the configured dt
+    bool quantize;              // snapshots hold GPUParticleQ16 instead of GPUParticle
+    Box view;                   // see particles_write_gpu_view
+    bool republish;             // the view changed, publish even without a tick
+    bool view_set;              // the render sent its view, the density grid maps onto the window
+    float lod_threshold;        // particles per pixel in view from which snapshots are density grids
+    float pixels;               // of the window the view fills
+    uint32_t grid_w;            // density grid, lod_tile pixels per cell
+    uint32_t grid_h;
+    float* lod_bins;            // particles_write_density scratch, NULL while there is no lod
+    SimState state;
+    uint32_t steps;
+    Pacer pacer;
+    TripleBuffer snapshots;
+    SimCommand commands[SIM_COMMANDS];
+    atomic_uint command_head;   // next free, render thread
+    atomic_uint command_tail;   // next to run, physics thread
+    atomic_bool quit;
+    SimStats stats;
+} SimThread;
+
+
+uint64_t sim_now_ns(void);
+// mapped NULL: the snapshots get memory of their own. Otherwise the render
+// maps the upload buffers of slots 0 and 1 and slot 2 starts as its front.
+int sim_thread_start(SimThread* sim, Chunkmap* chunkmap, Container* container, float particle_radius, const Config* config, void* mapped[2]);
+// Bytes per particle in a snapshot.
+uint32_t sim_thread_particle_size(const Config* config);
+// Cells of the density grid, the window in lod_tile pixel tiles.
+void sim_thread_grid_size(const Config* config, uint32_t* grid_w, uint32_t* grid_h);
+// Joins the physics thread, the chunkmap belongs to the caller again.
+void sim_thread_stop(SimThread* sim);
+int sim_thread_command(SimThread* sim, SimCommandType type, float value);
+// The render camera moved, the next snapshots cull to view.
+int sim_thread_view(SimThread* sim, Box view);
+// The latest published snapshot, *fresh says whether it is new since the
+// last call. Mapped slots: remapped is the front slot mapped again, the
+// swap hands it back to the physics thread and only happens with one, NULL
+// keeps the current snapshot. Without mapped slots pass NULL. Render
+// thread only.
+const Snapshot* sim_thread_snapshot(SimThread* sim, void* remapped, bool* fresh);
+// Whether a new snapshot is waiting, it stays true until
+// sim_thread_snapshot takes it. Render thread only.
+bool sim_thread_fresh(SimThread* sim);
+void sim_stats_print(SimThread* sim, FILE* out);
+
+#endif
@@ -0,0 +1,129 @@
+#include "pressure-sim-threadpool.h"
+#include <stdlib.h> 
+#include <stdio.h> 
+#include <unistd.h> 
+
+
+typedef struct {
+    Threadpool* pool; 
+    uint32_t thread; 
+} WorkerArgs; 
+
+
+static void threadpool_drain(Threadpool* pool, uint32_t thread) {
+    uint32_t task; 
+    while ((task = atomic_fetch_add_explicit(&pool->next_task, 1, memory_order_relaxed)) < pool->tasks) {
+        pool->fn(pool->ctx, task, thread); 
+    }
+}
+
+
+static void* threadpool_worker(void* arg) {
+    WorkerArgs args = *(WorkerArgs*)arg; 
+    free(arg); 
+    Threadpool* pool = args.pool; 
+    uint64_t seen = 0; 
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex); 
+        while (pool->generation == seen && !pool->quit) {
+            pthread_cond_wait(&pool->start, &pool->mutex); 
+        }
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->mutex); 
+            return NULL; 
+        }
+        seen = pool->generation; 
+        pthread_mutex_unlock(&pool->mutex); 
+
+        threadpool_drain(pool, args.thread); 
+
+        pthread_mutex_lock(&pool->mutex); 
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done); 
+        }
+        pthread_mutex_unlock(&pool->mutex); 
+    }
+}
+
+
+uint32_t threadpool_default_threads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN); 
+    return cores > 0 ? (uint32_t) cores : 1; 
+}
+
+
+int threadpool_init(Threadpool* pool, uint32_t threads) {
+    *pool = (Threadpool) { 0 }; 
+    pool->threads = threads == 0 ? threadpool_default_threads() : threads; 
+    pthread_mutex_init(&pool->mutex, NULL); 
+    pthread_cond_init(&pool->start, NULL); 
+    pthread_cond_init(&pool->done, NULL); 
+    atomic_init(&pool->next_task, 0); 
+    pool->workers = calloc(pool->threads, sizeof pool->workers[0]); 
+    if (pool->workers == NULL) {
+        fprintf(stderr, "ERROR: malloc of %d worker threads failed.\n", pool->threads);
+        return -1; 
+    }
+    // worker 0 is the caller of threadpool_run 
+    for (uint32_t t = 1; t < pool->threads; t++) {
+        WorkerArgs* args = malloc(sizeof *args); 
+        if (args == NULL) {
+            fprintf(stderr, "ERROR: malloc of worker args failed.\n");
+            pool->threads = t; 
+            threadpool_destroy(pool); 
+            return -1; 
+        }
+        *args = (WorkerArgs) { .pool = pool, .thread = t }; 
+        if (pthread_create(&pool->workers[t], NULL, threadpool_worker, args) != 0) {
+            fprintf(stderr, "ERROR: pthread_create of worker %d failed.\n", t);
+            free(args); 
+            pool->threads = t; 
+            threadpool_destroy(pool); 
+            return -1; 
+        }
+    }
+    return 0; 
+}
+
+
+void threadpool_destroy(Threadpool* pool) {
+    pthread_mutex_lock(&pool->mutex); 
+    pool->quit = true; 
+    pthread_cond_broadcast(&pool->start); 
+    pthread_mutex_unlock(&pool->mutex); 
+    for (uint32_t t = 1; t < pool->threads; t++) {
+        pthread_join(pool->workers[t], NULL); 
+    }
+    free(pool->workers); 
+    pool->workers = NULL; 
+    pthread_cond_destroy(&pool->done); 
+    pthread_cond_destroy(&pool->start); 
+    pthread_mutex_destroy(&pool->mutex); 
+}
+
+
+void threadpool_run(Threadpool* pool, ThreadpoolFn fn, void* ctx, uint32_t tasks) {
+    if (pool->threads <= 1 || tasks <= 1) {
+        for (uint32_t task = 0; task < tasks; task++) {
+            fn(ctx, task, 0); 
+        }
+        return; 
+    }
+    pthread_mutex_lock(&pool->mutex); 
+    pool->fn = fn; 
+    pool->ctx = ctx; 
+    pool->tasks = tasks; 
+    atomic_store_explicit(&pool->next_task, 0, memory_order_relaxed); 
+    pool->running = pool->threads - 1; 
+    pool->generation++; 
+    pthread_cond_broadcast(&pool->start); 
+    pthread_mutex_unlock(&pool->mutex); 
+
+    threadpool_drain(pool, 0); 
+
+    pthread_mutex_lock(&pool->mutex); 
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex); 
+    }
+    pthread_mutex_unlock(&pool->mutex); 
+}
@@ -0,0 +1,39 @@
+#ifndef PS_THREADPOOL_H_
+#define PS_THREADPOOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+
+// task: index in [0, tasks), thread: index in [0, threads) of the running thread
+typedef void (*ThreadpoolFn)(void* ctx, uint32_t task, uint32_t thread);
+
+
+// Fixed set of worker threads that run one batch of tasks at a time.
+// The calling thread takes part as thread 0, so threads=1 spawns nothing.
+typedef struct {
+    pthread_t* workers;
+    uint32_t threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;  // bumped for every batch
+    uint32_t running;     // workers still busy with the current batch
+    bool quit;
+    ThreadpoolFn fn;
+    void* ctx;
+    uint32_t tasks;
+    atomic_uint next_task;
+} Threadpool;
+
+
+uint32_t threadpool_default_threads(void);
+// threads=0 uses one thread per online core
+int threadpool_init(Threadpool* pool, uint32_t threads);
+void threadpool_destroy(Threadpool* pool);
+// Runs fn for every task and returns when all of them are done.
+void threadpool_run(Threadpool* pool, ThreadpoolFn fn, void* ctx, uint32_t tasks);
+
+#endif
@@ -14,11 +14,6 @@ const SDL_FColor COLOR_PINK        = { 1.0f, 0.0f, 1.0f, 1.0f };
 const SDL_FColor COLOR_GRAY        = { RGBA_TO_FLOAT(36, 36, 36, 255) }; 
 
 
-float rand_float(float min, float max) {
-    return min + (max - min) * (rand() / (float)RAND_MAX);
-}
-
-
 SDL_GPUShader* load_shader(
     SDL_GPUDevice* device, 
     const char* filename, 
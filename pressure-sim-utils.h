@@ -31,9 +31,6 @@ typedef struct Vec2Vertex {
 } Vec2Vertex;
 
 
-float rand_float(float min, float max);
-
-
 SDL_GPUShader* load_shader(
     SDL_GPUDevice* device, 
     const char* filename, 
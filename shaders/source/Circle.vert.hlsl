@@ -1,10 +1,18 @@
+// 8 byte stride, matches GPUParticle with -fvk-use-scalar-layout
 struct Particle { 
     float2 Position; 
-    float2 padd; 
 };
 
 StructuredBuffer<Particle> ParticleDataBuffer: register(t0, space0);
 
+// GPUParticleTransform, the camera 
+cbuffer UBO : register(b0, space1)
+{
+    float2 Scale : packoffset(c0.x);
+    float2 Offset : packoffset(c0.z);
+    float QuadScale : packoffset(c1.x);
+};
+
 struct Input
 {
     float3 Position    : TEXCOORD0;
@@ -27,8 +35,9 @@ struct Output
 Output main(Input input)
 {
     Output output;
-    float x = input.Position.x + ParticleDataBuffer[input.InstanceIndex].Position.x;
-    float y = input.Position.y + ParticleDataBuffer[input.InstanceIndex].Position.y;
+    float2 position = ParticleDataBuffer[input.InstanceIndex].Position * Scale + Offset + input.Position.xy * QuadScale;
+    float x = position.x;
+    float y = position.y;
     output.Color1 = input.Color1;  
     output.Color2 = input.Color2;  
     output.Position = float4(x, y, 0.0f, 1.0f); 
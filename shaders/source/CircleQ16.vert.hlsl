@@ -0,0 +1,43 @@
+// Circle.vert.hlsl with GPUParticleQ16 positions: two 16 bit unorm container 
+// coords per uint, low half x, high half y 
+StructuredBuffer<uint> ParticleDataBuffer: register(t0, space0);
+
+// GPUParticleTransform, the decode with the camera folded in: gpu = q * Scale + Offset 
+cbuffer UBO : register(b0, space1)
+{
+    float2 Scale : packoffset(c0.x);
+    float2 Offset : packoffset(c0.z);
+    float QuadScale : packoffset(c1.x);
+};
+
+struct Input
+{
+    float3 Position    : TEXCOORD0;
+    float2 UV          : TEXCOORD1;
+    float4 Color1      : TEXCOORD2;
+    float4 Color2      : TEXCOORD3;
+    uint InstanceIndex : SV_InstanceID;
+};
+
+struct Output
+{
+    float4 Position : SV_Position;
+    float4 Color1   : TEXCOORD0;
+    float4 Color2   : TEXCOORD1;
+    float2 UV       : TEXCOORD2;
+    [[vk::builtin("PointSize")]]
+	float PointSize : PSIZE0; 
+};
+
+Output main(Input input)
+{
+    Output output;
+    uint q = ParticleDataBuffer[input.InstanceIndex];
+    float2 position = float2(q & 0xffff, q >> 16) * Scale + Offset + input.Position.xy * QuadScale;
+    output.Color1 = input.Color1;  
+    output.Color2 = input.Color2;  
+    output.Position = float4(position.x, position.y, 0.0f, 1.0f); 
+	output.PointSize = 40.0f; 
+    output.UV = input.UV - 0.5f; 
+    return output;
+}
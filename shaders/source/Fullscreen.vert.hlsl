@@ -0,0 +1,17 @@
+// One triangle over the whole viewport, no vertex buffer: vertices 0, 1, 2 
+// at (-1,-1), (3,-1), (-1,3). The density grid rows go bottom up like the 
+// container's y, so v does too. 
+struct Output
+{
+    float2 TexCoord : TEXCOORD0;
+    float4 Position : SV_Position;
+};
+
+Output main(uint VertexIndex : SV_VertexID)
+{
+    Output output;
+    float2 uv = float2((VertexIndex << 1) & 2, VertexIndex & 2);
+    output.TexCoord = uv;
+    output.Position = float4(uv * 2.0f - 1.0f, 0.0f, 1.0f);
+    return output;
+}
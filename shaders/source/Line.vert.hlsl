@@ -6,6 +6,14 @@ struct Line {
 
 StructuredBuffer<Line> line_data_buffer: register(t0, space0);
 
+// GPUParticleTransform without quantization, the camera 
+cbuffer UBO : register(b0, space1)
+{
+    float2 Scale : packoffset(c0.x);
+    float2 Offset : packoffset(c0.z);
+    float QuadScale : packoffset(c1.x);
+};
+
 struct Input {
     float2 position : TEXCOORD0;
     uint instance_index: SV_InstanceID;
@@ -33,6 +41,7 @@ Output main(Input input) {
 			output.position = float4(x, y, 0.0f, 1.0f); 
 		}
 	}
+	output.position.xy = output.position.xy * Scale + Offset; 
 	output.color = float4(1.0f, 0.0f, 0.0f, 1.0f); 
 	return output; 
 }